@@ -0,0 +1,234 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include "accesslog.h"
+
+namespace {
+
+// Writes s as a JSON string
+void write_string(FILE* f, const char* s) {
+
+  fputc('"', f);
+  for ( ; *s; ++s)
+      if (*s == '"' || *s == '\\')
+          fputc('\\', f), fputc(*s, f);
+      else if ((unsigned char)*s >= 0x20)
+          fputc(*s, f);
+  fputc('"', f);
+}
+
+// Writes the key and value strings of a query as a JSON string, encoded like
+// a URI query ("mode=wdl&bestmove=true")
+void write_query(FILE* f, const char* query, size_t size) {
+
+  bool key = true;
+
+  fputc('"', f);
+  for (const char* p = query; p < query + size; ++p)
+  {
+      if (!*p)
+      {
+          if (p + 1 < query + size)
+              fputc(key ? '=' : '&', f);
+          key = !key;
+      }
+      else if (isalnum((unsigned char)*p) || strchr("-._~", *p))
+          fputc(*p, f);
+      else
+          fprintf(f, "%%%02X", (unsigned char)*p);
+  }
+  fputc('"', f);
+}
+
+} // namespace
+
+// The ring is a bounded multi-producer queue after Dmitry Vyukov: a cell may
+// be written once its sequence equals the position of the producer, and read
+// once it equals that position plus one.
+
+/// AccessLog::open() appends to the file at path and starts the background
+/// thread. Returns false if the file cannot be opened or the log is already
+/// open.
+
+bool AccessLog::open(const std::string& path) {
+
+  if (opened)
+      return false;
+
+  file = fopen(path.c_str(), "a");
+  if (!file)
+      return false;
+
+  filename = path;
+  opened = true;
+  for (size_t i = 0; i < Capacity; ++i)
+      ring[i].sequence = i;
+  head = tail = 0;
+  dropped = 0;
+  stopping = reopening = false;
+  writer = std::thread(&AccessLog::run, this);
+  return true;
+}
+
+
+/// AccessLog::close() writes the remaining entries and stops the background
+/// thread.
+
+void AccessLog::close() {
+
+  if (!opened)
+      return;
+
+  opened = false;
+  stopping = true;
+  writer.join();
+  fclose(file);
+  file = nullptr;
+}
+
+
+/// AccessLog::log() enqueues an entry without blocking, or drops it if the
+/// background thread is too far behind.
+
+void AccessLog::log(const Entry& e) {
+
+  size_t pos = head.load(std::memory_order_relaxed);
+
+  while (true)
+  {
+      Cell& cell = ring[pos & (Capacity - 1)];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+
+      if (seq == pos)
+      {
+          if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+              cell.entry = e;
+              cell.sequence.store(pos + 1, std::memory_order_release);
+              return;
+          }
+      }
+      else if (seq < pos)
+      {
+          dropped.fetch_add(1, std::memory_order_relaxed); // Full
+          return;
+      }
+      else
+          pos = head.load(std::memory_order_relaxed);
+  }
+}
+
+
+bool AccessLog::pop(Entry& e) {
+
+  // Only the background thread pops
+  size_t pos = tail.load(std::memory_order_relaxed);
+  Cell& cell = ring[pos & (Capacity - 1)];
+
+  if (cell.sequence.load(std::memory_order_acquire) != pos + 1)
+      return false;
+
+  e = cell.entry;
+  cell.sequence.store(pos + Capacity, std::memory_order_release);
+  tail.store(pos + 1, std::memory_order_relaxed);
+  return true;
+}
+
+
+void AccessLog::write(const Entry& e) {
+
+  time_t seconds = time_t(e.time / 1000000);
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  fprintf(file, "{\"time\": \"%s.%06dZ\", \"path\": ", timestamp, int(e.time % 1000000));
+  write_string(file, e.path);
+  fprintf(file, ", \"fen\": ");
+  write_string(file, e.fen);
+  fprintf(file, ", \"query\": ");
+  write_query(file, e.query, e.query_size);
+  fprintf(file, ", \"status\": %d, \"bytes\": %u, \"latency_us\": %lld, \"positions\": %u, \"lookups\": %d, \"tables\": [",
+          e.status, e.bytes, (long long)e.latency, e.positions, e.tables.lookups);
+
+  for (int i = 0; i < e.tables.count; ++i)
+      fprintf(file, i ? ", \"%s\"" : "\"%s\"", e.tables.names[i]);
+
+  fprintf(file, "]}\n");
+}
+
+
+void AccessLog::run() {
+
+  Entry e;
+  uint64_t reported = 0;
+
+  while (true)
+  {
+      bool stop = stopping.load(); // Before draining, so nothing is left behind
+      bool idle = true;
+
+      while (pop(e))
+      {
+          write(e);
+          idle = false;
+      }
+
+      uint64_t d = dropped.load(std::memory_order_relaxed);
+      if (d != reported)
+      {
+          fprintf(file, "{\"dropped\": %llu}\n", (unsigned long long)(d - reported));
+          reported = d;
+      }
+
+      if (!idle)
+          fflush(file);
+
+      if (reopening.exchange(false))
+      {
+          FILE* f = fopen(filename.c_str(), "a");
+          if (f)
+          {
+              fclose(file);
+              file = f;
+          }
+          else
+              std::cout << "could not reopen access log " << filename << std::endl;
+      }
+
+      if (stop)
+          break;
+
+      if (idle)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
@@ -0,0 +1,91 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ACCESSLOG_H_INCLUDED
+#define ACCESSLOG_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "syzygy/tbprobe.h"
+
+/// AccessLog writes one JSON line per request. Request threads only copy a
+/// fixed size entry into a lock-free ring; formatting and writing happen on a
+/// background thread. If the ring is full, entries are dropped and counted
+/// rather than blocking the request. reopen() makes the background thread
+/// reopen the file, for rotation with logrotate and SIGHUP.
+
+class AccessLog {
+public:
+  struct Entry {
+    int64_t time;     // Microseconds since the epoch
+    char path[32];
+    char fen[96];
+    char query[64];   // Other parameters as decoded key and value strings
+    uint32_t query_size;
+    int status;
+    uint32_t bytes;
+    int64_t latency;  // Microseconds
+    uint32_t positions; // Probed for the reply, tables.lookups counts all probes
+    Tablebases::TableLog tables;
+  };
+
+  AccessLog() : ring(Capacity) {}
+  ~AccessLog() { close(); }
+
+  bool open(const std::string& path);
+  void close();
+  bool is_open() const { return opened; }
+
+  void log(const Entry& e);
+  void reopen() { reopening = true; }
+
+private:
+  static const size_t Capacity = 4096; // Power of two
+
+  struct Cell {
+    std::atomic<size_t> sequence;
+    Entry entry;
+  };
+
+  bool pop(Entry& e);
+  void write(const Entry& e);
+  void run();
+
+  std::vector<Cell> ring;
+  std::atomic<size_t> head, tail; // Next cell to push to, next cell to pop
+  std::atomic<uint64_t> dropped;
+  std::atomic<bool> stopping, reopening;
+  std::string filename;
+  FILE* file = nullptr;  // Owned by the background thread while open
+  bool opened = false;
+  std::thread writer;
+};
+
+#endif // #ifndef ACCESSLOG_H_INCLUDED
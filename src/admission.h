@@ -0,0 +1,122 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ADMISSION_H_INCLUDED
+#define ADMISSION_H_INCLUDED
+
+#include <cstdint>
+#include <deque>
+
+#include "thread_win32.h"
+
+enum Priority {
+  PRIORITY_INTERACTIVE, PRIORITY_BATCH, PRIORITY_NB
+};
+
+/// AdmissionQueue is the bounded queue in front of the worker threads.
+/// Interactive items are always taken before batch items. When the queue is
+/// full, an interactive item displaces the newest batch item, otherwise the
+/// new item is rejected, so that the caller can shed it right away.
+
+template<typename T>
+class AdmissionQueue {
+public:
+  struct Stats {
+    size_t capacity;
+    size_t depth[PRIORITY_NB];
+    uint64_t admitted[PRIORITY_NB];
+    uint64_t shed[PRIORITY_NB];     // Including evicted ones
+    uint64_t evicted;               // Batch items shed after being admitted
+  };
+
+  explicit AdmissionQueue(size_t cap) : capacity(cap) {}
+
+  // Returns false if the item was not admitted. Otherwise evicted may be set
+  // to a batch item that was dropped to make room.
+  bool push(T item, Priority p, T& evicted, bool& has_evicted) {
+
+    std::unique_lock<Mutex> lk(mutex);
+    has_evicted = false;
+
+    if (queues[PRIORITY_INTERACTIVE].size() + queues[PRIORITY_BATCH].size() >= capacity)
+    {
+        if (p == PRIORITY_BATCH || queues[PRIORITY_BATCH].empty())
+        {
+            shed[p]++;
+            return false;
+        }
+
+        evicted = queues[PRIORITY_BATCH].back();
+        queues[PRIORITY_BATCH].pop_back();
+        has_evicted = true;
+        evicted_count++;
+        shed[PRIORITY_BATCH]++;
+    }
+
+    queues[p].push_back(item);
+    admitted[p]++;
+    lk.unlock();
+    cv.notify_one();
+    return true;
+  }
+
+  // Blocks until an item is available
+  T pop() {
+
+    std::unique_lock<Mutex> lk(mutex);
+    cv.wait(lk, [&]{ return !queues[PRIORITY_INTERACTIVE].empty() || !queues[PRIORITY_BATCH].empty(); });
+
+    std::deque<T>& q = queues[queues[PRIORITY_INTERACTIVE].empty() ? PRIORITY_BATCH : PRIORITY_INTERACTIVE];
+    T item = q.front();
+    q.pop_front();
+    return item;
+  }
+
+  Stats stats() {
+
+    std::unique_lock<Mutex> lk(mutex);
+    Stats s;
+    s.capacity = capacity;
+    s.evicted = evicted_count;
+    for (int p = 0; p < PRIORITY_NB; ++p)
+    {
+        s.depth[p] = queues[p].size();
+        s.admitted[p] = admitted[p];
+        s.shed[p] = shed[p];
+    }
+    return s;
+  }
+
+private:
+  Mutex mutex;
+  ConditionVariable cv;
+  size_t capacity;
+  std::deque<T> queues[PRIORITY_NB];
+  uint64_t admitted[PRIORITY_NB] = {};
+  uint64_t shed[PRIORITY_NB] = {};
+  uint64_t evicted_count = 0;
+};
+
+#endif // #ifndef ADMISSION_H_INCLUDED
@@ -0,0 +1,88 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include "arena.h"
+
+Arena::~Arena() {
+
+  reset();
+  free(buffer);
+}
+
+
+/// Arena::allocate() returns size bytes aligned to align, a power of two.
+/// Allocations that do not fit into the buffer are served by malloc and make
+/// the next reset() grow the buffer.
+
+void* Arena::allocate(size_t size, size_t align) {
+
+  size_t offset = (used + align - 1) & ~(align - 1);
+
+  if (offset + size <= capacity)
+  {
+      used = offset + size;
+      return buffer + offset;
+  }
+
+  used = offset + size;
+  void* p = malloc(size + align - 1);
+  if (!p)
+  {
+      std::cout << "could not allocate " << size << " bytes of scratch space" << std::endl;
+      abort();
+  }
+  overflow.push_back(p);
+  return (void*)((uintptr_t(p) + align - 1) & ~(align - 1));
+}
+
+
+/// Arena::reset() releases all allocations. If they did not fit, the buffer
+/// is replaced by one that is large enough.
+
+void Arena::reset() {
+
+  for (void* p : overflow)
+      free(p);
+  overflow.clear();
+
+  if (used > capacity)
+  {
+      free(buffer);
+      capacity = std::max(size_t(MinCapacity), 2 * used);
+      buffer = (char*)malloc(capacity);
+      if (!buffer)
+      {
+          std::cout << "could not allocate " << capacity << " bytes of scratch space" << std::endl;
+          abort();
+      }
+  }
+
+  used = 0;
+}
@@ -0,0 +1,68 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <cstddef>
+#include <vector>
+
+/// Arena is a monotonic allocator for the scratch data of a request, like
+/// the move infos of GET /. Allocations bump a pointer and are released all at
+/// once by reset() when the request is done. The buffer is kept from request
+/// to request and grows to the largest request seen, so that handling
+/// requests does not call malloc in the steady state. Each thread that
+/// handles requests uses its own, see Arena::local().
+
+class Arena {
+public:
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  ~Arena();
+
+  void* allocate(size_t size, size_t align);
+  void reset();
+
+  template<typename T>
+  T* alloc(size_t n) { return static_cast<T*>(allocate(n * sizeof(T), alignof(T))); }
+
+  /// The arena of the current thread. Kept local to an inline function, so
+  /// that no TLS wrapper is needed to reach it.
+  static Arena& local() {
+    static thread_local Arena arena;
+    return arena;
+  }
+
+private:
+  static const size_t MinCapacity = 64 * 1024;
+
+  char* buffer = nullptr;
+  size_t capacity = 0;
+  size_t used = 0;              // Including what did not fit into the buffer
+  std::vector<void*> overflow;  // Allocations that did not fit, until reset()
+};
+
+#endif // #ifndef ARENA_H_INCLUDED
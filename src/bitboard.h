@@ -280,7 +280,9 @@ inline Bitboard attacks_bb(PieceType pt, Square s, Bitboard occupied) {
 
 inline int popcount(Bitboard b) {
 
-#ifndef USE_POPCNT
+// USE_DISPATCH only clones functions for popcnt with gcc compatible compilers
+// (see DISPATCH_CLONES), other compilers use the table.
+#if !defined(USE_POPCNT) && !(defined(USE_DISPATCH) && defined(__GNUC__) && !defined(__INTEL_COMPILER))
 
   extern uint8_t PopCnt16[1 << 16];
   union { Bitboard bb; uint16_t u[4]; } v = { b };
@@ -0,0 +1,165 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "generator.h"
+
+namespace {
+
+// Tries for a new signature before giving up on it, e.g. "KvKQQQQQQQQQ"
+const int MaxAttempts = 10000;
+
+} // namespace
+
+
+EndgameGenerator::EndgameGenerator(Variant v, uint64_t seed) : var(v), rng(seed ? seed : 1) {}
+
+
+/// EndgameGenerator::add() adds a material signature with the given weight.
+/// Returns false if the code is malformed or has no legal placement in the
+/// variant.
+
+bool EndgameGenerator::add(const std::string& code, double weight) {
+
+  if (weight <= 0 || std::count(code.begin(), code.end(), 'v') != 1)
+      return false;
+
+  Signature sig;
+  sig.code = code;
+  sig.pieces[0] = code.substr(0, code.find('v'));
+  sig.pieces[1] = code.substr(code.find('v') + 1);
+
+  for (const std::string& side : sig.pieces)
+      if (   side.length() > 16
+          || side.find_first_not_of("PNBRQK") != std::string::npos)
+          return false;
+
+  Position pos;
+  StateInfo st;
+  int attempt = 0;
+  while (!place(sig, pos, &st, nullptr))
+      if (++attempt == MaxAttempts)
+          return false;
+
+  signatures.push_back(sig);
+  cumulative.push_back((cumulative.empty() ? 0 : cumulative.back()) + weight);
+  return true;
+}
+
+
+/// EndgameGenerator::add_list() adds comma separated signatures, each with an
+/// optional weight: "KQvK,KRPvKR:2.5".
+
+bool EndgameGenerator::add_list(const std::string& list) {
+
+  std::stringstream ss(list);
+  std::string token;
+
+  while (std::getline(ss, token, ','))
+  {
+      if (token.empty())
+          continue;
+
+      size_t colon = token.find(':');
+      double weight = colon == std::string::npos ? 1.0 : atof(token.c_str() + colon + 1);
+
+      if (!add(token.substr(0, colon), weight))
+          return false;
+  }
+
+  return true;
+}
+
+
+/// EndgameGenerator::next() sets up pos with a random legal position and
+/// returns its material signature.
+
+const std::string& EndgameGenerator::next(Position& pos, StateInfo* si, Thread* th) {
+
+  assert(!empty());
+
+  double r = (rng.rand<uint64_t>() >> 11) * (cumulative.back() / double(1ULL << 53));
+  size_t idx = std::upper_bound(cumulative.begin(), cumulative.end(), r) - cumulative.begin();
+  const Signature& sig = signatures[std::min(idx, signatures.size() - 1)];
+
+  while (!place(sig, pos, si, th)) {}
+
+  return sig.code;
+}
+
+
+/// EndgameGenerator::place() puts the pieces of a signature on random squares,
+/// pawns not on the first and last rank. The FEN parser rejects placements
+/// that are not legal in the variant, e.g. with the side not to move in check.
+
+bool EndgameGenerator::place(const Signature& sig, Position& pos, StateInfo* si, Thread* th) {
+
+  char board[SQUARE_NB] = {};
+  uint64_t bits = rng.rand<uint64_t>();
+  Color strong = Color(bits & 1);
+  Color stm = Color((bits >> 1) & 1);
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      for (char token : sig.pieces[c == strong ? 0 : 1])
+      {
+          Square s;
+          do {
+              s = Square(rng.rand<uint64_t>() & 63);
+          } while (board[s] || (token == 'P' && (rank_of(s) == RANK_1 || rank_of(s) == RANK_8)));
+
+          board[s] = c == WHITE ? token : char(tolower(token));
+      }
+
+  // Board, side to move and no castling or en passant
+  char fen[96];
+  char* p = fen;
+  for (Rank r = RANK_8; r >= RANK_1; --r)
+  {
+      int empty = 0;
+      for (File f = FILE_A; f <= FILE_H; ++f)
+      {
+          char piece = board[make_square(f, r)];
+          if (!piece)
+              empty++;
+          else
+          {
+              if (empty)
+                  *p++ = char('0' + empty);
+              empty = 0;
+              *p++ = piece;
+          }
+      }
+      if (empty)
+          *p++ = char('0' + empty);
+      *p++ = r > RANK_1 ? '/' : ' ';
+  }
+  *p++ = stm == WHITE ? 'w' : 'b';
+  strcpy(p, " - - 0 1");
+
+  return pos.parse_fen(fen, false, var, si, th) == FEN_OK;
+}
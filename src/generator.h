@@ -0,0 +1,65 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GENERATOR_H_INCLUDED
+#define GENERATOR_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "misc.h"
+#include "position.h"
+
+/// EndgameGenerator produces random legal positions for material signatures
+/// like "KRPvKR". As in Position::set(code, Color, Variant, StateInfo*), the
+/// pieces before the 'v' belong to the strong side, which gets a random color.
+/// Signatures are picked in proportion to their weights, so that a mix can be
+/// uniform or follow the material distribution of real traffic.
+
+class EndgameGenerator {
+public:
+  EndgameGenerator(Variant v, uint64_t seed);
+
+  bool add(const std::string& code, double weight = 1.0);
+  bool add_list(const std::string& list);
+  bool empty() const { return signatures.empty(); }
+
+  const std::string& next(Position& pos, StateInfo* si, Thread* th = nullptr);
+
+private:
+  struct Signature {
+    std::string code;
+    std::string pieces[COLOR_NB]; // [Strong / weak], as FEN letters
+  };
+
+  bool place(const Signature& sig, Position& pos, StateInfo* si, Thread* th);
+
+  Variant var;
+  PRNG rng;
+  std::vector<Signature> signatures;
+  std::vector<double> cumulative; // Running sum of the weights
+};
+
+#endif // #ifndef GENERATOR_H_INCLUDED
@@ -34,8 +34,13 @@ typedef bool(*fun1_t)(LOGICAL_PROCESSOR_RELATIONSHIP,
 typedef bool(*fun2_t)(USHORT, PGROUP_AFFINITY);
 typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
+#else
+#include <sched.h>
+#include <sys/mman.h>
 #endif
 
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -211,6 +216,75 @@ void prefetch2(void* addr) {
   prefetch((uint8_t*)addr + 64);
 }
 
+
+/// large_page_alloc() allocates zeroed memory for large, randomly accessed
+/// tables, backed by huge pages on Linux so that accesses need fewer TLB
+/// entries. These are reserved huge pages (MAP_HUGETLB) if there are enough of
+/// them, otherwise transparent huge pages. Tables smaller than a huge page get
+/// normal pages, rather than a mostly unused huge page. Windows and other
+/// systems always get normal pages. The length to pass to large_page_free() is
+/// stored in *mapped. Returns nullptr if the memory could not be allocated.
+
+void* large_page_alloc(size_t size, size_t* mapped) {
+
+#if defined(_WIN32)
+
+  *mapped = size;
+  return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+#elif defined(__linux__)
+
+  const size_t HugePageSize = 2 * 1024 * 1024;
+
+  if (size < HugePageSize)
+  {
+      void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      return mem == MAP_FAILED ? nullptr : (*mapped = size, mem);
+  }
+
+  size_t len = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+
+  void* mem = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mem != MAP_FAILED)
+      return *mapped = len, mem;
+
+  // Transparent huge pages only back aligned 2 MB ranges, so map a bit more
+  // and trim it to an aligned range.
+  char* raw = (char*)mmap(nullptr, len + HugePageSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED)
+      return nullptr;
+
+  char* aligned = (char*)(((uintptr_t)raw + HugePageSize - 1) & ~(HugePageSize - 1));
+  if (aligned != raw)
+      munmap(raw, aligned - raw);
+  munmap(aligned + len, raw + HugePageSize - aligned);
+
+  madvise(aligned, len, MADV_HUGEPAGE);
+  return *mapped = len, aligned;
+
+#else
+
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return mem == MAP_FAILED ? nullptr : (*mapped = size, mem);
+
+#endif
+}
+
+
+/// large_page_free() releases memory from large_page_alloc()
+
+void large_page_free(void* mem, size_t mapped) {
+
+#ifdef _WIN32
+  (void)mapped;
+  VirtualFree(mem, 0, MEM_RELEASE);
+#else
+  munmap(mem, mapped);
+#endif
+}
+
 namespace WinProcGroup {
 
 #ifndef _WIN32
@@ -323,3 +397,113 @@ void bindThisThread(size_t idx) {
 #endif
 
 } // namespace WinProcGroup
+
+namespace Numa {
+
+namespace {
+
+thread_local int CurrentNode = -1;
+
+#ifdef __linux__
+
+// Reads a list of ids like "0-3,8-11\n" as found in /sys/devices/system/node
+vector<int> read_ids(const string& path) {
+
+  vector<int> ids;
+  ifstream file(path);
+  string range;
+
+  while (getline(file, range, ','))
+  {
+      int first, last;
+      int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+      if (n < 1)
+          continue;
+
+      for (int id = first; id <= (n == 2 ? last : first); ++id)
+          ids.push_back(id);
+  }
+
+  return ids;
+}
+
+// Node ids may have gaps, e.g. after taking a node offline
+const vector<int>& node_ids() {
+
+  static const vector<int> ids = read_ids("/sys/devices/system/node/online");
+  return ids;
+}
+
+#endif
+
+} // namespace
+
+
+/// Numa::nodes() returns the number of NUMA nodes, 1 if the OS does not tell
+
+int nodes() {
+
+#if defined(_WIN32)
+  ULONG highest;
+  return GetNumaHighestNodeNumber(&highest) ? int(highest) + 1 : 1;
+#elif defined(__linux__)
+  return std::max(int(node_ids().size()), 1);
+#else
+  return 1;
+#endif
+}
+
+
+/// Numa::bind() restricts the calling thread to the processors of the given
+/// node. Returns false if this is not supported or failed.
+
+bool bind(int node) {
+
+  assert(0 <= node && node < nodes());
+
+#if defined(_WIN32)
+
+  // Early exit if the needed API are not available at runtime
+  HMODULE k32 = GetModuleHandle("Kernel32.dll");
+  auto fun2 = (fun2_t)GetProcAddress(k32, "GetNumaNodeProcessorMaskEx");
+  auto fun3 = (fun3_t)GetProcAddress(k32, "SetThreadGroupAffinity");
+
+  GROUP_AFFINITY affinity;
+  if (   !fun2 || !fun3
+      || !fun2(USHORT(node), &affinity)
+      || !fun3(GetCurrentThread(), &affinity, nullptr))
+      return false;
+
+#elif defined(__linux__)
+
+  if (node_ids().empty())
+      return false;
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int cpu : read_ids("/sys/devices/system/node/node" + to_string(node_ids()[node]) + "/cpulist"))
+      if (cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &cpus);
+
+  if (!CPU_COUNT(&cpus) || sched_setaffinity(0, sizeof(cpus), &cpus))
+      return false;
+
+#else
+
+  return false;
+
+#endif
+
+  CurrentNode = node;
+  return true;
+}
+
+
+/// Numa::node() returns the node of the last successful bind() of the calling
+/// thread, or -1.
+
+int node() {
+  return CurrentNode;
+}
+
+} // namespace Numa
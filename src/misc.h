@@ -32,6 +32,8 @@
 const std::string engine_info(bool to_uci = false);
 void prefetch(void* addr);
 void prefetch2(void* addr);
+void* large_page_alloc(size_t size, size_t* mapped);
+void large_page_free(void* mem, size_t mapped);
 void start_logger(const std::string& fname);
 
 void dbg_hit_on(bool b);
@@ -109,4 +111,16 @@ namespace WinProcGroup {
   void bindThisThread(size_t idx);
 }
 
+
+/// On NUMA machines threads can be bound to the processors of a node, so that
+/// the memory they touch first is allocated on that node, see large_page_alloc().
+/// Nodes are numbered 0 .. nodes() - 1. node() is the node the calling thread
+/// was bound to, or -1 if it was not.
+
+namespace Numa {
+  int nodes();
+  bool bind(int node);
+  int node();
+}
+
 #endif // #ifndef MISC_H_INCLUDED
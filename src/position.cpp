@@ -29,13 +29,16 @@
 #include "misc.h"
 #include "movegen.h"
 #include "position.h"
+#ifndef TBCORE
 #include "thread.h"
 #include "tt.h"
+#endif
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 
 using std::string;
 
+#ifndef TBCORE
 namespace PSQT {
 #ifdef CRAZYHOUSE
   extern Score psq[VARIANT_NB][PIECE_NB][SQUARE_NB+1];
@@ -43,6 +46,7 @@ namespace PSQT {
   extern Score psq[VARIANT_NB][PIECE_NB][SQUARE_NB];
 #endif
 }
+#endif
 
 namespace Zobrist {
 
@@ -66,6 +70,7 @@ const string PieceToChar(" PNBRQK  pnbrqk");
 const Piece Pieces[] = { W_PAWN, W_KNIGHT, W_BISHOP, W_ROOK, W_QUEEN, W_KING,
                          B_PAWN, B_KNIGHT, B_BISHOP, B_ROOK, B_QUEEN, B_KING };
 
+#ifndef TBCORE
 // min_attacker() is a helper function used by see_ge() to locate the least
 // valuable attacker for the side to move, remove the attacker we just found
 // from the bitboards and scan for new X-ray attacks behind it.
@@ -94,6 +99,7 @@ template<>
 PieceType min_attacker<KING>(const Bitboard*, Square, Bitboard, Bitboard&, Bitboard&) {
   return KING; // No need to update bitboards: it is the last cycle
 }
+#endif
 
 } // namespace
 
@@ -289,89 +295,12 @@ Position& Position::set(const string& fenStr, bool isChess960, Variant v, StateI
   // if an inner rook is associated with the castling right, the castling tag is
   // replaced by the file letter of the involved rook, as for the Shredder-FEN.
   while ((ss >> token) && !isspace(token))
-  {
-      Square rsq;
-      Color c = islower(token) ? BLACK : WHITE;
-      Rank rank = relative_rank(c, RANK_1);
-      Square ksq = square<KING>(c);
-#ifdef ANTI
-      if (is_anti())
-      {
-#ifdef SUICIDE
-          if (is_suicide())
-              continue;
-#endif
-          // X-FEN is ambiguous if there are multiple kings
-          // Assume the first king on the rank has castling rights
-          const Square* kl = squares<KING>(c);
-          while ((ksq = *kl++) != SQ_NONE)
-          {
-              assert(piece_on(ksq) == make_piece(c, KING));
-              if (rank_of(ksq) == rank)
-                  break;
-          }
-      }
-#endif
-#ifdef EXTINCTION
-      if (is_extinction())
-      {
-          // X-FEN is ambiguous if there are multiple kings
-          // Assume the first king on the rank has castling rights
-          const Square* kl = squares<KING>(c);
-          while ((ksq = *kl++) != SQ_NONE)
-          {
-              assert(piece_on(ksq) == make_piece(c, KING));
-              if (rank_of(ksq) == rank)
-                  break;
-          }
-      }
-#endif
-      if (rank_of(ksq) != rank)
-          continue;
-      Piece rook = make_piece(c, ROOK);
-
-      token = char(toupper(token));
-
-      if (token == 'K')
-          for (rsq = relative_square(c, SQ_H1); rsq != ksq && piece_on(rsq) != rook; --rsq) {}
-
-      else if (token == 'Q')
-          for (rsq = relative_square(c, SQ_A1); rsq != ksq && piece_on(rsq) != rook; ++rsq) {}
-
-      else if (token >= 'A' && token <= 'H')
-          rsq = make_square(File(token - 'A'), rank);
-
-      else
-          continue;
-
-      if (rsq != ksq)
-          set_castling_right(c, ksq, rsq);
-  }
+      set_castling(token);
 
   // 4. En passant square. Ignore if no pawn capture is possible
   if (((ss >> col) && (col >= 'a' && col <= 'h'))
         && ((ss >> row) && (sideToMove ? row == '3' : row == '6')))
-  {
-      st->epSquare = make_square(File(col - 'a'), Rank(row - '1'));
-
-      if (   !(attackers_to(st->epSquare) & pieces(sideToMove, PAWN))
-          || !(pieces(~sideToMove, PAWN) & (st->epSquare + pawn_push(~sideToMove))))
-          st->epSquare = SQ_NONE;
-      else if (SquareBB[st->epSquare] & pieces())
-          st->epSquare = SQ_NONE;
-      else if (sideToMove == WHITE && (shift<NORTH>(SquareBB[st->epSquare]) & pieces()))
-          st->epSquare = SQ_NONE;
-      else if (sideToMove == BLACK && (shift<SOUTH>(SquareBB[st->epSquare]) & pieces()))
-          st->epSquare = SQ_NONE;
-      else if (sideToMove == WHITE && !(shift<SOUTH>(SquareBB[st->epSquare]) & pieces(BLACK, PAWN)))
-          st->epSquare = SQ_NONE;
-      else if (sideToMove == BLACK && !(shift<NORTH>(SquareBB[st->epSquare]) & pieces(WHITE, PAWN)))
-          st->epSquare = SQ_NONE;
-#ifdef ATOMIC
-      else if (attacks_from<KING>(st->epSquare) && square<KING>(sideToMove))
-          st->epSquare = SQ_NONE;
-#endif
-  }
+      set_ep_square(make_square(File(col - 'a'), Rank(row - '1')));
   else
       st->epSquare = SQ_NONE;
 
@@ -418,6 +347,275 @@ Position& Position::set(const string& fenStr, bool isChess960, Variant v, StateI
 }
 
 
+/// Position::parse_fen() is a strict alternative to set() for untrusted input.
+/// The FEN is validated while the position is built, in a single pass over the
+/// string and without copying it. Underscores are accepted in place of spaces,
+/// so that FENs can be passed in URLs. All six fields are required. Returns
+/// FEN_OK or the first problem found, in which case the position must not be
+/// used.
+
+FenError Position::parse_fen(const char* fen, bool isChess960, Variant v, StateInfo* si, Thread* th) {
+
+  auto is_space = [](char c) { return c == ' ' || c == '_'; };
+  auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+
+  size_t idx;
+  char token;
+
+  std::memset(this, 0, sizeof(Position));
+  std::memset(si, 0, sizeof(StateInfo));
+  std::fill_n(&pieceList[0][0], sizeof(pieceList) / sizeof(Square), SQ_NONE);
+  st = si;
+  subvar = v;
+  var = main_variant(v);
+
+  // 1. Piece placement. Every rank must add up to exactly eight files and
+  // there may be no two consecutive digits.
+  for (Rank r = RANK_8; r >= RANK_1; --r)
+  {
+      int f = FILE_A;
+      bool lastWasDigit = false;
+
+      while (f <= FILE_H)
+      {
+          token = *fen++;
+
+          if (token >= '1' && token <= '8')
+          {
+              if (lastWasDigit || f + token - '0' > FILE_NB)
+                  return FEN_BOARD;
+
+              f += token - '0';
+              lastWasDigit = true;
+              continue;
+          }
+
+          if (token == ' ' || (idx = PieceToChar.find(token)) == string::npos)
+              return FEN_BOARD;
+
+          Piece pc = Piece(idx);
+
+          if (type_of(pc) == PAWN && (r == RANK_1 || r == RANK_8))
+              return FEN_BOARD;
+
+          if (pieceCount[make_piece(color_of(pc), ALL_PIECES)] == 16)
+              return FEN_ILLEGAL;
+
+          put_piece(pc, make_square(File(f++), r));
+          lastWasDigit = false;
+      }
+
+      token = *fen++;
+      if (r > RANK_1 ? token != '/' : !is_space(token))
+          return FEN_BOARD;
+  }
+
+  // Exactly one king per side, except that in atomic one of them may have
+  // exploded already, and in antichess kings are ordinary pieces.
+  bool kingsOk = pieceCount[W_KING] == 1 && pieceCount[B_KING] == 1;
+#ifdef ATOMIC
+  if (is_atomic())
+      kingsOk =   pieceCount[W_KING] <= 1 && pieceCount[B_KING] <= 1
+               && pieceCount[W_KING] + pieceCount[B_KING] >= 1;
+#endif
+#ifdef ANTI
+  if (is_anti())
+      kingsOk = true;
+#endif
+  if (!kingsOk)
+      return FEN_KINGS;
+
+  // 2. Active color
+  token = *fen++;
+  if ((token != 'w' && token != 'b') || !is_space(*fen++))
+      return FEN_TURN;
+
+  sideToMove = (token == 'w' ? WHITE : BLACK);
+
+  // 3. Castling availability, in any of the notations accepted by set()
+  if (*fen == '-')
+  {
+      if (!is_space(*++fen))
+          return FEN_CASTLING;
+  }
+  else
+      do {
+          token = *fen;
+          if (   !(token >= 'a' && token <= 'h') && !(token >= 'A' && token <= 'H')
+              && token != 'k' && token != 'K' && token != 'q' && token != 'Q')
+              return FEN_CASTLING;
+
+          set_castling(token);
+      } while (!is_space(*++fen));
+
+  fen++;
+
+  // 4. En passant square. Ignore if no pawn capture is possible
+  st->epSquare = SQ_NONE;
+
+  if (*fen == '-')
+      fen++;
+  else
+  {
+      char col = *fen++;
+      if (col < 'a' || col > 'h')
+          return FEN_EN_PASSANT;
+
+      char row = *fen++;
+      if (row != '3' && row != '6')
+          return FEN_EN_PASSANT;
+
+      if (sideToMove ? row == '3' : row == '6')
+          set_ep_square(make_square(File(col - 'a'), Rank(row - '1')));
+  }
+
+  if (!is_space(*fen++))
+      return FEN_EN_PASSANT;
+
+  // 5. Halfmove clock. Saturate rather than overflow on absurd values.
+  if (!is_digit(*fen))
+      return FEN_HALFMOVE;
+
+  while (is_digit(*fen))
+      st->rule50 = std::min(st->rule50 * 10 + (*fen++ - '0'), 1 << 20);
+
+  if (!is_space(*fen++))
+      return FEN_HALFMOVE;
+
+  // 6. Fullmove number, which must be the end of the string
+  if (!is_digit(*fen))
+      return FEN_FULLMOVE;
+
+  while (is_digit(*fen))
+      gamePly = std::min(gamePly * 10 + (*fen++ - '0'), 1 << 20);
+
+  if (*fen)
+      return FEN_FULLMOVE;
+
+  gamePly = std::max(2 * (gamePly - 1), 0) + (sideToMove == BLACK);
+
+  chess960 = isChess960;
+  thisThread = th;
+  set_state(st);
+
+  // Finally the parts of pos_is_ok() that can fail for a position built this
+  // way: pawn count, castling rights without a rook, and the side not to move
+  // being in check.
+  if (pieceCount[W_PAWN] > 8 || pieceCount[B_PAWN] > 8)
+      return FEN_ILLEGAL;
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      for (CastlingSide s = KING_SIDE; s <= QUEEN_SIDE; s = CastlingSide(s + 1))
+          if (can_castle(c | s) && piece_on(castlingRookSquare[c | s]) != make_piece(c, ROOK))
+              return FEN_CASTLING;
+
+#ifdef ANTI
+  if (is_anti())
+      return FEN_OK;
+#endif
+#ifdef ATOMIC
+  if (is_atomic() && (is_atomic_win() || is_atomic_loss() || kings_adjacent()))
+      return FEN_OK;
+#endif
+
+  if (attackers_to(square<KING>(~sideToMove)) & pieces(sideToMove))
+      return FEN_ILLEGAL;
+
+  return FEN_OK;
+}
+
+
+/// Position::set_castling() is a helper function used to set castling rights
+/// from a single token of the castling field of a FEN.
+
+void Position::set_castling(char token) {
+
+  Square rsq;
+  Color c = islower(token) ? BLACK : WHITE;
+  Rank rank = relative_rank(c, RANK_1);
+  Square ksq = square<KING>(c);
+#ifdef ANTI
+  if (is_anti())
+  {
+#ifdef SUICIDE
+      if (is_suicide())
+          return;
+#endif
+      // X-FEN is ambiguous if there are multiple kings
+      // Assume the first king on the rank has castling rights
+      const Square* kl = squares<KING>(c);
+      while ((ksq = *kl++) != SQ_NONE)
+      {
+          assert(piece_on(ksq) == make_piece(c, KING));
+          if (rank_of(ksq) == rank)
+              break;
+      }
+  }
+#endif
+#ifdef EXTINCTION
+  if (is_extinction())
+  {
+      // X-FEN is ambiguous if there are multiple kings
+      // Assume the first king on the rank has castling rights
+      const Square* kl = squares<KING>(c);
+      while ((ksq = *kl++) != SQ_NONE)
+      {
+          assert(piece_on(ksq) == make_piece(c, KING));
+          if (rank_of(ksq) == rank)
+              break;
+      }
+  }
+#endif
+  if (rank_of(ksq) != rank)
+      return;
+  Piece rook = make_piece(c, ROOK);
+
+  token = char(toupper(token));
+
+  if (token == 'K')
+      for (rsq = relative_square(c, SQ_H1); rsq != ksq && piece_on(rsq) != rook; --rsq) {}
+
+  else if (token == 'Q')
+      for (rsq = relative_square(c, SQ_A1); rsq != ksq && piece_on(rsq) != rook; ++rsq) {}
+
+  else if (token >= 'A' && token <= 'H')
+      rsq = make_square(File(token - 'A'), rank);
+
+  else
+      return;
+
+  if (rsq != ksq)
+      set_castling_right(c, ksq, rsq);
+}
+
+
+/// Position::set_ep_square() is a helper function used to set the en passant
+/// square of a FEN, but only if an en passant capture is actually possible.
+
+void Position::set_ep_square(Square s) {
+
+  st->epSquare = s;
+
+  if (   !(attackers_to(st->epSquare) & pieces(sideToMove, PAWN))
+      || !(pieces(~sideToMove, PAWN) & (st->epSquare + pawn_push(~sideToMove))))
+      st->epSquare = SQ_NONE;
+  else if (SquareBB[st->epSquare] & pieces())
+      st->epSquare = SQ_NONE;
+  else if (sideToMove == WHITE && (shift<NORTH>(SquareBB[st->epSquare]) & pieces()))
+      st->epSquare = SQ_NONE;
+  else if (sideToMove == BLACK && (shift<SOUTH>(SquareBB[st->epSquare]) & pieces()))
+      st->epSquare = SQ_NONE;
+  else if (sideToMove == WHITE && !(shift<SOUTH>(SquareBB[st->epSquare]) & pieces(BLACK, PAWN)))
+      st->epSquare = SQ_NONE;
+  else if (sideToMove == BLACK && !(shift<NORTH>(SquareBB[st->epSquare]) & pieces(WHITE, PAWN)))
+      st->epSquare = SQ_NONE;
+#ifdef ATOMIC
+  else if (attacks_from<KING>(st->epSquare) && square<KING>(sideToMove))
+      st->epSquare = SQ_NONE;
+#endif
+}
+
+
 /// Position::set_castling_right() is a helper function used to set castling
 /// rights given the corresponding color and the rook starting square.
 
@@ -583,9 +781,11 @@ void Position::set_state(StateInfo* si) const {
       Square s = pop_lsb(&b);
       Piece pc = piece_on(s);
       si->key ^= Zobrist::psq[pc][s];
+#ifndef TBCORE
       si->psq += PSQT::psq[var][pc][s];
+#endif
   }
-#ifdef CRAZYHOUSE
+#if defined(CRAZYHOUSE) && !defined(TBCORE)
   if (is_house())
   {
       for (Piece pc : Pieces)
@@ -609,8 +809,10 @@ void Position::set_state(StateInfo* si) const {
 
   for (Piece pc : Pieces)
   {
+#ifndef TBCORE
       if (type_of(pc) != PAWN && type_of(pc) != KING)
           si->nonPawnMaterial[color_of(pc)] += pieceCount[pc] * PieceValue[CHESS_VARIANT][MG][pc];
+#endif
 
       for (int cnt = 0; cnt < pieceCount[pc]; ++cnt)
           si->materialKey ^= Zobrist::psq[pc][cnt];
@@ -618,8 +820,10 @@ void Position::set_state(StateInfo* si) const {
 #ifdef CRAZYHOUSE
       if (is_house())
       {
+#ifndef TBCORE
           if (type_of(pc) != PAWN && type_of(pc) != KING)
               si->nonPawnMaterial[color_of(pc)] += pieceCountInHand[color_of(pc)][type_of(pc)] * PieceValue[CHESS_VARIANT][MG][pc];
+#endif
           si->key ^= Zobrist::inHand[pc][pieceCountInHand[color_of(pc)][type_of(pc)]];
       }
 #endif
@@ -1244,7 +1448,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   assert(!is_extinction() || !givesCheck);
 #endif
 
+#ifndef TBCORE
   thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
+#endif
   Key k = st->key ^ Zobrist::side;
 
   // Copy some fields of the old state to our new StateInfo object except the
@@ -1295,7 +1501,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       Square rfrom, rto;
       do_castling<true>(us, from, to, rfrom, rto);
 
+#ifndef TBCORE
       st->psq += PSQT::psq[var][captured][rto] - PSQT::psq[var][captured][rfrom];
+#endif
       k ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
       captured = NO_PIECE;
   }
@@ -1323,6 +1531,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
           st->pawnKey ^= Zobrist::psq[captured][capsq];
       }
+#ifndef TBCORE
       else
       {
           st->nonPawnMaterial[them] -= PieceValue[CHESS_VARIANT][MG][captured];
@@ -1338,6 +1547,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           }
 #endif
       }
+#endif
 
       // Update board and piece lists
       remove_piece(captured, capsq);
@@ -1351,7 +1561,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           {
               Piece add = is_promoted(to) ? make_piece(~color_of(captured), PAWN) : ~captured;
               add_to_hand(color_of(add), type_of(add));
+#ifndef TBCORE
               st->psq += PSQT::psq[var][add][SQ_NONE];
+#endif
               k ^= Zobrist::inHand[add][pieceCountInHand[color_of(add)][type_of(add)] - 1]
                   ^ Zobrist::inHand[add][pieceCountInHand[color_of(add)][type_of(add)]];
           }
@@ -1373,8 +1585,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
               st->blast[bsq] = bpc;
               if (bpc != NO_PIECE && type_of(bpc) != PAWN)
               {
+#ifndef TBCORE
                   Color bc = color_of(st->blast[bsq]);
                   st->nonPawnMaterial[bc] -= PieceValue[CHESS_VARIANT][MG][type_of(bpc)];
+#endif
 
                   // Update board and piece lists
                   remove_piece(bpc, bsq);
@@ -1383,8 +1597,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
                   k ^= Zobrist::psq[bpc][bsq];
                   st->materialKey ^= Zobrist::psq[bpc][pieceCount[bpc]];
 
+#ifndef TBCORE
                   // Update incremental scores
                   st->psq -= PSQT::psq[var][bpc][bsq];
+#endif
 
                   // Update castling rights if needed
                   if (st->castlingRights && castlingRightsMask[bsq])
@@ -1398,10 +1614,12 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       }
 #endif
 
+#ifndef TBCORE
       prefetch(thisThread->materialTable[st->materialKey]);
 
       // Update incremental scores
       st->psq -= PSQT::psq[var][captured][capsq];
+#endif
 
       // Reset rule 50 counter
       st->rule50 = 0;
@@ -1465,8 +1683,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       remove_piece(pc, from);
       // Update material (hash key already updated)
       st->materialKey ^= Zobrist::psq[pc][pieceCount[pc]];
+#ifndef TBCORE
       if (type_of(pc) != PAWN)
           st->nonPawnMaterial[us] -= PieceValue[CHESS_VARIANT][MG][type_of(pc)];
+#endif
   }
   else
 #endif
@@ -1539,11 +1759,13 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           st->materialKey ^=  Zobrist::psq[promotion][pieceCount[promotion]-1]
                             ^ Zobrist::psq[pc][pieceCount[pc]];
 
+#ifndef TBCORE
           // Update incremental score
           st->psq += PSQT::psq[var][promotion][to] - PSQT::psq[var][pc][to];
 
           // Update material
           st->nonPawnMaterial[us] += PieceValue[CHESS_VARIANT][MG][promotion];
+#endif
       }
 
       // Update pawn hash key and prefetch access to pawnsTable
@@ -1558,12 +1780,15 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       else
 #endif
       st->pawnKey ^= Zobrist::psq[pc][from] ^ Zobrist::psq[pc][to];
+#ifndef TBCORE
       prefetch2(thisThread->pawnsTable[st->pawnKey]);
+#endif
 
       // Reset rule 50 draw counter
       st->rule50 = 0;
   }
 
+#ifndef TBCORE
 #ifdef ATOMIC
   if (is_atomic() && captured)
       st->psq -= PSQT::psq[var][pc][from];
@@ -1571,6 +1796,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 #endif
   // Update incremental scores
   st->psq += PSQT::psq[var][pc][to] - PSQT::psq[var][pc][from];
+#endif
 
   // Set capture piece
   st->capturedPiece = captured;
@@ -1784,7 +2010,9 @@ void Position::do_null_move(StateInfo& newSt) {
   }
 
   st->key ^= Zobrist::side;
+#ifndef TBCORE
   prefetch(TT.first_entry(st->key));
+#endif
 
   ++st->rule50;
   st->pliesFromNull = 0;
@@ -1855,6 +2083,7 @@ Key Position::key_after(Move m) const {
   return k ^ Zobrist::psq[pc][to] ^ Zobrist::psq[pc][from];
 }
 
+#ifndef TBCORE
 #ifdef ATOMIC
 template<>
 Value Position::see<ATOMIC_VARIANT>(Move m) const {
@@ -2059,6 +2288,7 @@ bool Position::see_ge(Move m, Value threshold) const {
   // If the opponent gave up we win, otherwise we lose.
   return opponentToMove;
 }
+#endif
 
 
 /// Position::is_draw() tests whether the position is drawn by 50-move rule
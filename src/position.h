@@ -75,6 +75,21 @@ struct StateInfo {
 typedef std::unique_ptr<std::deque<StateInfo>> StateListPtr;
 
 
+/// FenError tells which part of an untrusted FEN was rejected by
+/// Position::parse_fen().
+enum FenError {
+  FEN_OK,
+  FEN_BOARD,      // Malformed piece placement
+  FEN_KINGS,      // Wrong number of kings for the variant
+  FEN_TURN,
+  FEN_CASTLING,
+  FEN_EN_PASSANT,
+  FEN_HALFMOVE,
+  FEN_FULLMOVE,
+  FEN_ILLEGAL     // Well-formed, but not a legal position
+};
+
+
 /// Position class stores information regarding the board representation as
 /// pieces, side to move, hash keys, castling info, etc. Important methods are
 /// do_move() and undo_move(), used by the search to update node info when
@@ -92,6 +107,7 @@ public:
   // FEN string input/output
   Position& set(const std::string& fenStr, bool isChess960, Variant v, StateInfo* si, Thread* th);
   Position& set(const std::string& code, Color c, Variant v, StateInfo* si);
+  FenError parse_fen(const char* fen, bool isChess960, Variant v, StateInfo* si, Thread* th);
   const std::string fen() const;
 
   // Position representation
@@ -161,11 +177,13 @@ public:
   void undo_null_move();
 
   // Static Exchange Evaluation
+#ifndef TBCORE
 #ifdef ATOMIC
   template<Variant V>
   Value see(Move m) const;
 #endif
   bool see_ge(Move m, Value threshold = VALUE_ZERO) const;
+#endif
 
   // Accessing hash keys
   Key key() const;
@@ -275,9 +293,11 @@ public:
   Thread* this_thread() const;
   bool is_draw(int ply) const;
   int rule50_count() const;
+#ifndef TBCORE
   Score psq_score() const;
   Value non_pawn_material(Color c) const;
   Value non_pawn_material() const;
+#endif
 
   // Position consistency check, for debugging
   bool pos_is_ok() const;
@@ -285,7 +305,9 @@ public:
 
 private:
   // Initialization helpers (used while setting up a position)
+  void set_castling(char token);
   void set_castling_right(Color c, Square kfrom, Square rfrom);
+  void set_ep_square(Square s);
   void set_state(StateInfo* si) const;
   void set_check_info(StateInfo* si) const;
 
@@ -582,6 +604,7 @@ inline Key Position::material_key() const {
   return st->materialKey;
 }
 
+#ifndef TBCORE
 inline Score Position::psq_score() const {
   return st->psq;
 }
@@ -593,6 +616,7 @@ inline Value Position::non_pawn_material(Color c) const {
 inline Value Position::non_pawn_material() const {
   return st->nonPawnMaterial[WHITE] + st->nonPawnMaterial[BLACK];
 }
+#endif
 
 inline int Position::game_ply() const {
   return gamePly;
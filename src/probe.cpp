@@ -0,0 +1,508 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef GAVIOTA
+#include <mutex>
+
+#include <gtb-probe.h>
+#endif
+
+#include "probe.h"
+#include "trace.h"
+#include "uci.h"
+#include "syzygy/tbprobe.h"
+
+thread_local uint64_t probes = 0;
+int verbose = 0;
+
+// Collect the origin squares of all legal moves by piece type and destination
+// square, so that move_san() can disambiguate without scanning the move list
+// again for every move.
+void san_origins(const Position &pos, const MoveList<LEGAL> &legals, Bitboard origins[][SQUARE_NB]) {
+  for (const ExtMove &m : legals)
+      origins[type_of(pos.moved_piece(m))][to_sq(m)] = 0;
+
+  for (const ExtMove &m : legals)
+      origins[type_of(pos.moved_piece(m))][to_sq(m)] |= from_sq(m);
+}
+
+// Write the SAN of a legal move, without check or checkmate suffix, to san
+// and return a pointer to the end of it. The caller provides at least 8 bytes.
+char *move_san(const Position &pos, Move move, const Bitboard origins[][SQUARE_NB], char *san) {
+  Square from = from_sq(move);
+  Square to = to_sq(move);
+
+  if (type_of(move) == CASTLING) {
+      const char *castling = to > from ? "O-O" : "O-O-O";
+      strcpy(san, castling);
+      return san + strlen(castling);
+  }
+
+  PieceType pt = type_of(pos.piece_on(from));
+
+  if (pt == PAWN) {
+      if (file_of(from) != file_of(to)) {
+          *san++ = char('a' + file_of(from));
+          *san++ = 'x';
+      }
+      *san++ = char('a' + file_of(to));
+      *san++ = char('1' + rank_of(to));
+      if (type_of(move) == PROMOTION) {
+          *san++ = '=';
+          *san++ = " PNBRQK"[promotion_type(move)];
+      }
+      *san = '\0';
+      return san;
+  }
+
+  *san++ = " PNBRQK"[pt];
+
+  // Other pieces of the same type that can move to the same square. Any of
+  // them on another file requires the file, any on the same file the rank.
+  Bitboard others = origins[pt][to] ^ from;
+  if (others & ~file_bb(from)) *san++ = char('a' + file_of(from));
+  if (others & file_bb(from)) *san++ = char('1' + rank_of(from));
+
+  if (pos.piece_on(to)) *san++ = 'x';
+  *san++ = char('a' + file_of(to));
+  *san++ = char('1' + rank_of(to));
+  *san = '\0';
+  return san;
+}
+
+// Write a legal move in coordinate notation, like UCI::move(move, true) but
+// without allocating, to uci and return a pointer to the end of it. Castling
+// is king captures rook. The caller provides at least 8 bytes.
+char *move_uci(Move move, char *uci) {
+  Square from = from_sq(move);
+  Square to = to_sq(move);
+
+  *uci++ = char('a' + file_of(from));
+  *uci++ = char('1' + rank_of(from));
+  *uci++ = char('a' + file_of(to));
+  *uci++ = char('1' + rank_of(to));
+  if (type_of(move) == PROMOTION) *uci++ = " pnbrqk"[promotion_type(move)];
+  *uci = '\0';
+  return uci;
+}
+
+namespace {
+
+template<Variant>
+bool insufficient_material(const Position &) {
+  return false;
+}
+
+template<>
+bool insufficient_material<CHESS_VARIANT>(const Position &pos) {
+  // Easy mating material
+  if (pos.pieces(PAWN) || pos.pieces(ROOK) || pos.pieces(QUEEN)) return false;
+
+  // A single knight or a single bishop
+  if (popcount(pos.pieces(KNIGHT) | pos.pieces(BISHOP)) == 1) return true;
+
+  // More than a single knight
+  if (pos.pieces(KNIGHT)) return false;
+
+  // All bishops on the same color
+  if (!(pos.pieces(BISHOP) & DarkSquares)) return true;
+  else if (!(pos.pieces(BISHOP) & ~DarkSquares)) return true;
+  else return false;
+}
+
+#ifdef ATOMIC
+template<>
+bool insufficient_material<ATOMIC_VARIANT>(const Position &pos) {
+  // King already dead.
+  if (pos.is_atomic_win() || pos.is_atomic_loss()) return false;
+
+  // Sometimes sufficient mating material
+  if (pos.pieces(PAWN) || pos.pieces(QUEEN)) return false;
+
+  // A single knight, bishop or rook
+  if (popcount(pos.pieces(KNIGHT) | pos.pieces(BISHOP) | pos.pieces(ROOK)) == 1) return true;
+
+  // Only knights
+  if (pos.pieces() == (pos.pieces(KING) | pos.pieces(KNIGHT))) return popcount(pos.pieces(KNIGHT)) <= 2;
+
+  // Only bishops
+  if (pos.pieces() == (pos.pieces(KING) | pos.pieces(BISHOP))) {
+      // All bishops on opposite colors
+      if (!(pos.pieces(WHITE, BISHOP) & DarkSquares))
+          return !(pos.pieces(BLACK, BISHOP) & ~DarkSquares);
+      if (!(pos.pieces(WHITE, BISHOP) & ~DarkSquares))
+          return !(pos.pieces(BLACK, BISHOP) & DarkSquares);
+  }
+
+  return false;
+}
+#endif
+
+} // namespace
+
+bool insufficient_material(const Position &pos) {
+  switch (pos.variant()) {
+      case CHESS_VARIANT: return insufficient_material<CHESS_VARIANT>(pos);
+#ifdef ATOMIC
+      case ATOMIC_VARIANT: return insufficient_material<ATOMIC_VARIANT>(pos);
+#endif
+      default: return false;
+  }
+}
+
+// Variant specific game endings, from the point of view of the side to move.
+// num_moves is the number of legal moves.
+bool variant_win(const Position &pos, size_t num_moves) {
+#ifdef ATOMIC
+  if (pos.is_atomic()) return pos.is_atomic_win();
+#endif
+#ifdef ANTI
+  if (pos.is_anti()) return num_moves == 0 || pos.is_anti_win();
+#endif
+  (void)pos; (void)num_moves; // Silence warnings in single variant builds
+  return false;
+}
+
+bool variant_loss(const Position &pos) {
+#ifdef ATOMIC
+  if (pos.is_atomic()) return pos.is_atomic_loss();
+#endif
+#ifdef ANTI
+  if (pos.is_anti()) return pos.is_anti_loss();
+#endif
+  (void)pos; // Silence a warning in single variant builds
+  return false;
+}
+
+bool compare_move_info(const MoveInfo &a, const MoveInfo &b) {
+  if (a.has_wdl && b.has_wdl && a.wdl != b.wdl) return a.wdl < b.wdl;
+  if (a.checkmate != b.checkmate) return a.checkmate;
+  if (a.variant_loss != b.variant_loss) return a.variant_loss;
+  if (a.variant_win != b.variant_win) return b.variant_win;
+  if (a.stalemate != b.stalemate) return a.stalemate;
+  if (a.insufficient_material != b.insufficient_material) return a.insufficient_material;
+
+  if (a.has_dtm && b.has_dtm && b.dtm != a.dtm) return b.dtm < a.dtm;
+
+  if (a.has_wdl && b.has_wdl && a.wdl < 0 && b.zeroing != a.zeroing) return a.zeroing;
+  if (a.has_wdl && b.has_wdl && a.wdl > 0 && a.zeroing != b.zeroing) return b.zeroing;
+
+  if (a.has_dtz && b.has_dtz && a.dtz != b.dtz) return b.dtz < a.dtz;
+
+  if (a.has_dtz != b.has_dtz) return b.has_dtz;
+  if (a.has_wdl != b.has_wdl) return b.has_wdl;
+
+  return strcmp(a.uci, b.uci) < 0;
+}
+
+#ifdef GAVIOTA
+namespace {
+
+// libgtb keeps one cache for all threads, so all probes are serialized
+std::mutex gaviota_mutex;
+
+const unsigned char GaviotaPieces[PIECE_TYPE_NB] = {
+  tb_NOPIECE, tb_PAWN, tb_KNIGHT, tb_BISHOP, tb_ROOK, tb_QUEEN, tb_KING
+};
+
+// The arguments of a Gaviota probe of a position with up to 5 pieces and its
+// result, so that probes can be made after the position has been undone
+struct DtmQuery {
+  Key material;
+  unsigned stm;
+  unsigned ep;
+  unsigned ws[6];
+  unsigned bs[6];
+  unsigned char wp[6];
+  unsigned char bp[6];
+
+  bool success;
+  int dtm;
+};
+
+// Fills in q for pos. Returns false if Gaviota has no DTM for pos.
+bool dtm_query(const Position &pos, DtmQuery &q) {
+  if (pos.variant() != CHESS_VARIANT) return false;
+  if (insufficient_material(pos)) return false;
+  if (popcount(pos.pieces()) > 5) return false;
+  if (pos.can_castle(ANY_CASTLING)) return false;
+
+  q.material = pos.material_key();
+  q.stm = pos.side_to_move() == WHITE ? tb_WHITE_TO_MOVE : tb_BLACK_TO_MOVE;
+  q.ep = pos.ep_square() != SQ_NONE ? TB_squares(pos.ep_square()) : tb_NOSQUARE;
+
+  unsigned i = 0;
+  for (Bitboard white = pos.pieces(WHITE); white; i++) {
+      Square sq = pop_lsb(&white);
+      q.ws[i] = sq;
+      q.wp[i] = GaviotaPieces[type_of(pos.piece_on(sq))];
+  }
+  q.ws[i] = tb_NOSQUARE;
+  q.wp[i] = tb_NOPIECE;
+
+  i = 0;
+  for (Bitboard black = pos.pieces(BLACK); black; i++) {
+      Square sq = pop_lsb(&black);
+      q.bs[i] = sq;
+      q.bp[i] = GaviotaPieces[type_of(pos.piece_on(sq))];
+  }
+  q.bs[i] = tb_NOSQUARE;
+  q.bp[i] = tb_NOPIECE;
+
+  q.success = false;
+  q.dtm = 0;
+  return true;
+}
+
+// Stores the result of a probe in q, as DTM from the point of view of the
+// side to move
+void dtm_result(DtmQuery &q, unsigned available, unsigned info, unsigned plies_to_mate) {
+  if (!available || info == tb_FORBID || info == tb_UNKNOWN) {
+      if (verbose) {
+          std::cout << "gaviota probe failed: info = " << info << std::endl;
+      }
+      return;
+  }
+
+  if (info == tb_DRAW) return;
+
+  q.success = true;
+
+  if (info == tb_WMATE && q.stm == tb_WHITE_TO_MOVE) {
+      q.dtm = plies_to_mate;
+  } else if (info == tb_BMATE && q.stm == tb_BLACK_TO_MOVE) {
+      q.dtm = plies_to_mate;
+  } else if (info == tb_WMATE && q.stm == tb_BLACK_TO_MOVE) {
+      q.dtm = -plies_to_mate;
+  } else if (info == tb_BMATE && q.stm == tb_WHITE_TO_MOVE) {
+      q.dtm = -plies_to_mate;
+  } else {
+      std::cout << "gaviota tablebase error, info = " << info << std::endl;
+      abort();
+  }
+}
+
+// Probes all queries, at most MAX_MOVES. Positions in the libgtb cache are
+// answered by soft probes first. The others need hard probes, which read the
+// files. These are made grouped by material, so that consecutive probes hit
+// the same table and its blocks just loaded into the cache.
+void probe_dtm(DtmQuery *queries, size_t num_queries) {
+  assert(num_queries <= MAX_MOVES);
+
+  DtmQuery *missed[MAX_MOVES];
+  size_t num_missed = 0;
+
+  {
+      Trace::Scope trace("probe_dtm", "soft");
+      std::lock_guard<std::mutex> lock(gaviota_mutex);
+      for (size_t i = 0; i < num_queries; i++) {
+          DtmQuery &q = queries[i];
+          unsigned info = tb_UNKNOWN, plies_to_mate = 0;
+          if (tb_probe_soft(q.stm, q.ep, 0, q.ws, q.bs, q.wp, q.bp, &info, &plies_to_mate) && info != tb_UNKNOWN) {
+              dtm_result(q, true, info, plies_to_mate);
+          } else {
+              missed[num_missed++] = &q;
+          }
+      }
+  }
+
+  std::sort(missed, missed + num_missed, [](const DtmQuery *a, const DtmQuery *b) {
+      return a->material < b->material;
+  });
+
+  for (size_t i = 0; i < num_missed; ) {
+      Trace::Scope trace("probe_dtm", "hard");
+      std::lock_guard<std::mutex> lock(gaviota_mutex);
+      Key material = missed[i]->material;
+      for (; i < num_missed && missed[i]->material == material; i++) {
+          DtmQuery &q = *missed[i];
+          unsigned info = 0, plies_to_mate = 0;
+          unsigned available = tb_probe_hard(q.stm, q.ep, 0, q.ws, q.bs, q.wp, q.bp, &info, &plies_to_mate);
+          dtm_result(q, available, info, plies_to_mate);
+      }
+  }
+
+  probes += num_queries;
+}
+
+} // namespace
+
+int probe_dtm(const Position &pos, bool *success) {
+  DtmQuery q;
+  if (!dtm_query(pos, q)) return *success = false, 0;
+
+  probe_dtm(&q, 1);
+  *success = q.success;
+  return q.dtm;
+}
+#endif
+
+// Fills in the game state and the tablebase values of pos, from the point of
+// view of the side to move. num_moves is the number of legal moves.
+void probe_position(Position &pos, size_t num_moves, ProbeMode mode, MoveInfo &info) {
+  info.checkmate = num_moves == 0 && pos.checkers();
+  info.variant_win = variant_win(pos, num_moves);
+  info.variant_loss = variant_loss(pos);
+  info.stalemate = num_moves == 0 && !info.checkmate && !info.variant_win && !info.variant_loss;
+  info.insufficient_material = insufficient_material(pos);
+  info.zeroing = pos.rule50_count() == 0;
+
+  if (info.checkmate || info.variant_loss) {
+      info.has_wdl = true;
+      info.wdl = -2;
+      info.has_dtm = info.checkmate;
+      info.dtm = 0;
+  } else if (info.variant_win) {
+      info.has_wdl = true;
+      info.wdl = 2;
+  } else if (info.stalemate || info.insufficient_material) {
+      info.has_wdl = true;
+      info.wdl = 0;
+  } else if (mode == MODE_WDL && !pos.can_castle(ANY_CASTLING) && popcount(pos.pieces()) <= Tablebases::VariantMaxCardinality[pos.subvariant()]) {
+      // Without DTZ the halfmove clock of the position is ignored, so a
+      // win may be reported as 2 even if the 50-move rule spoils it.
+      Tablebases::ProbeState state;
+      info.wdl = Tablebases::probe_wdl(pos, &state);
+      probes++;
+      info.has_wdl = state != Tablebases::FAIL;
+      if (!info.has_wdl) {
+          info.failed = true;
+#ifndef TBAPI_LIBRARY
+          std::cout << "wdl probe failed: " << pos.fen() << std::endl;
+#endif
+      }
+  } else if (!pos.can_castle(ANY_CASTLING) && popcount(pos.pieces()) <= Tablebases::VariantMaxCardinality[pos.subvariant()]) {
+      Tablebases::ProbeState state;
+      info.dtz = Tablebases::probe_dtz(pos, &state);
+      probes++;
+      info.has_dtz = state != Tablebases::FAIL;
+      if (!info.has_dtz) {
+          info.failed = true;
+#ifndef TBAPI_LIBRARY
+          std::cout << "dtz probe failed: " << pos.fen() << std::endl;
+#endif
+      } else {
+          info.has_wdl = true;
+          if (info.dtz < -100 && info.dtz - pos.rule50_count() <= -100) info.wdl = -1;
+          else if (info.dtz > 100 && info.dtz + pos.rule50_count() >= -100) info.wdl = 1;
+          else if (info.dtz < 0) info.wdl = -2;
+          else if (info.dtz > 0) info.wdl = 2;
+          else info.wdl = 0;
+
+#ifdef GAVIOTA
+          // Drawn positions have no DTM
+          if ((mode == MODE_FULL || mode == MODE_BEST) && info.wdl) {
+              info.dtm = probe_dtm(pos, &info.has_dtm);
+          }
+#endif
+      }
+  } else {
+      info.has_wdl = false;
+  }
+}
+
+// Probes the position after each legal move and sorts the results, best move
+// first, into move_infos, which has room for all legal moves. st is used as
+// scratch space for each child position. DTM is probed for all moves at once
+// after the DTZ probes, except for draws. With MODE_BEST only the moves of the
+// best WDL class get DTM, which is enough to order the moves that come first.
+// Returns the number of moves.
+size_t probe_moves(Position &pos, const MoveList<LEGAL> &legals, bool with_san, ProbeMode mode, StateInfo &st, MoveInfo *move_infos) {
+  Trace::Scope trace("probe_moves");
+
+#ifdef GAVIOTA
+  static thread_local DtmQuery queries[MAX_MOVES];
+  static thread_local MoveInfo *queried[MAX_MOVES];
+  size_t num_queries = 0;
+#endif
+
+  Bitboard origins[PIECE_TYPE_NB][SQUARE_NB];
+  if (with_san) san_origins(pos, legals, origins);
+
+  MoveInfo *info = move_infos;
+  for (const auto& m : legals) {
+      *info = MoveInfo();
+      move_uci(m, info->uci);
+      info->move = m;
+      char *san_end = with_san ? move_san(pos, m, origins, info->san) : nullptr;
+
+      pos.do_move(m, st);
+      probe_position(pos, MoveList<LEGAL>(pos).size(), mode == MODE_FULL || mode == MODE_BEST ? MODE_DTZ : mode, *info);
+
+#ifdef GAVIOTA
+      if ((mode == MODE_FULL || mode == MODE_BEST) && info->has_dtz && info->wdl && dtm_query(pos, queries[num_queries])) {
+          queried[num_queries++] = info;
+      }
+#endif
+
+      if (with_san) {
+          if (info->checkmate || info->variant_win || info->variant_loss) *san_end++ = '#';
+          else if (pos.checkers()) *san_end++ = '+';
+          *san_end = '\0';
+      }
+
+      info++;
+
+      pos.undo_move(m);
+  }
+
+#ifdef GAVIOTA
+  // The best moves are those with the lowest WDL for the opponent
+  if (mode == MODE_BEST && num_queries) {
+      int best = 2;
+      for (const MoveInfo *m = move_infos; m < info; m++) {
+          if (m->has_wdl) best = std::min(best, m->wdl);
+      }
+
+      size_t num_best = 0;
+      for (size_t i = 0; i < num_queries; i++) {
+          if (queried[i]->wdl != best) continue;
+          queries[num_best] = queries[i];
+          queried[num_best++] = queried[i];
+      }
+      num_queries = num_best;
+  }
+
+  if (num_queries) {
+      probe_dtm(queries, num_queries);
+      for (size_t i = 0; i < num_queries; i++) {
+          queried[i]->has_dtm = queries[i].success;
+          queried[i]->dtm = queries[i].dtm;
+      }
+  }
+#endif
+
+  std::sort(move_infos, info, compare_move_info);
+  return info - move_infos;
+}
+
+void probe_moves(Position &pos, const MoveList<LEGAL> &legals, bool with_san, ProbeMode mode, StateInfo &st, std::vector<MoveInfo> &move_infos) {
+  move_infos.resize(legals.size());
+  if (legals.size()) probe_moves(pos, legals, with_san, mode, st, &move_infos[0]);
+}
@@ -0,0 +1,92 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROBE_H_INCLUDED
+#define PROBE_H_INCLUDED
+
+#include <vector>
+
+#include "movegen.h"
+#include "position.h"
+
+/// How much to compute for each move, selected with the mode parameter
+enum ProbeMode {
+  MODE_WDL,   // probe_wdl() only
+  MODE_DTZ,   // probe_dtz(), which also yields WDL
+  MODE_BEST,  // Like MODE_FULL, but DTM only for the moves of the best WDL
+  MODE_FULL   // probe_dtz() and Gaviota DTM if available
+};
+
+/// The game state and tablebase values of a position, usually the one after
+/// a move, from the point of view of its side to move
+struct MoveInfo {
+  Move move;
+  char uci[8];
+  char san[8];
+
+  bool insufficient_material;
+  bool checkmate;
+  bool variant_win;
+  bool variant_loss;
+  bool stalemate;
+  bool zeroing;
+
+  bool failed;  // A table should cover the position, but could not be probed
+
+  bool has_wdl;
+  int wdl;
+
+  bool has_dtz;
+  int dtz;
+
+  bool has_dtm;
+  int dtm;
+};
+
+/// Number of tablebase probes made by the current thread
+extern thread_local uint64_t probes;
+
+/// Report failed Gaviota probes, set by --verbose
+extern int verbose;
+
+void san_origins(const Position& pos, const MoveList<LEGAL>& legals, Bitboard origins[][SQUARE_NB]);
+char* move_san(const Position& pos, Move move, const Bitboard origins[][SQUARE_NB], char* san);
+char* move_uci(Move move, char* uci);
+
+bool insufficient_material(const Position& pos);
+bool variant_win(const Position& pos, size_t num_moves);
+bool variant_loss(const Position& pos);
+
+bool compare_move_info(const MoveInfo& a, const MoveInfo& b);
+
+#ifdef GAVIOTA
+int probe_dtm(const Position& pos, bool* success);
+#endif
+
+void probe_position(Position& pos, size_t num_moves, ProbeMode mode, MoveInfo& info);
+size_t probe_moves(Position& pos, const MoveList<LEGAL>& legals, bool with_san, ProbeMode mode, StateInfo& st, MoveInfo* move_infos);
+void probe_moves(Position& pos, const MoveList<LEGAL>& legals, bool with_san, ProbeMode mode, StateInfo& st, std::vector<MoveInfo>& move_infos);
+
+#endif // #ifndef PROBE_H_INCLUDED
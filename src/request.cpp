@@ -0,0 +1,182 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cctype>
+#include <cstdlib>
+
+#include <event2/buffer.h>
+
+#include "arena.h"
+#include "movegen.h"
+#include "request.h"
+
+#ifdef TABLEBASE_VARIANT
+const std::vector<Route> routes = {
+  {"", TABLEBASE_VARIANT},
+};
+#else
+const std::vector<Route> routes = {
+  {"/standard", CHESS_VARIANT},
+#ifdef ATOMIC
+  {"/atomic", ATOMIC_VARIANT},
+#endif
+#ifdef ANTI
+  {"/antichess", ANTI_VARIANT},
+#endif
+};
+#endif
+
+namespace {
+
+// Whether s only has characters that RFC 3986 allows in a query or fragment,
+// as evhttp_uri_parse() checks
+bool valid_query(const char *s) {
+  for (; *s; s++) {
+      if (isalnum((unsigned char)*s) || strchr("-._~!$&'()*+,;=:@/?", *s)) continue;
+      if (*s == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+          s += 2;
+          continue;
+      }
+      return false;
+  }
+  return true;
+}
+
+// Decodes the query of the request into buf, as evhttp_parse_query() does
+// but without allocating: keys and decoded values follow each other as C
+// strings. Returns the number of bytes used, or size + 1 if the query does
+// not fit. A malformed query yields no parameters at all.
+size_t parse_query(struct evhttp_request *req, char *buf, size_t size) {
+  const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
+  const char *query = uri ? evhttp_uri_get_query(uri) : nullptr;
+  const char *fragment = uri ? evhttp_uri_get_fragment(uri) : nullptr;
+  if (!query || !valid_query(query) || (fragment && !valid_query(fragment))) return 0;
+
+  char *out = buf, *end = buf + size;
+  for (const char *p = query; *p; ) {
+      size_t len = strcspn(p, "&");
+      const char *eq = (const char *)memchr(p, '=', len);
+      if (!eq || eq == p) return 0;
+      if (size_t(end - out) < len + 1) return size + 1;
+
+      memcpy(out, p, eq - p);
+      out += eq - p;
+      *out++ = '\0';
+
+      for (const char *c = eq + 1; c < p + len; c++) {
+          if (*c == '+') *out++ = ' ';
+          else if (*c == '%' && c + 2 < p + len && isxdigit((unsigned char)c[1]) && isxdigit((unsigned char)c[2])) {
+              char hex[3] = { c[1], c[2], '\0' };
+              *out++ = char(strtol(hex, nullptr, 16));
+              c += 2;
+          }
+          else *out++ = *c;
+      }
+      *out++ = '\0';
+
+      p += len;
+      if (*p) p++;
+  }
+
+  return out - buf;
+}
+
+}  // namespace
+
+Request::Request(struct evhttp_request *req, Variant v) : variant(v) {
+  start = std::chrono::steady_clock::now();
+
+  const char *c_uri = evhttp_request_get_uri(req);
+  if (c_uri) uri = c_uri;
+  query_size = parse_query(req, query, sizeof(query));
+  if (query_size > sizeof(query)) {
+      query_size = 0;
+      status = HTTP_URITOOLONG;
+      reason = "URI Too Long";
+  }
+}
+
+Request::~Request() {
+  if (body) evbuffer_free(body);
+}
+
+void write_move_infos(struct evbuffer *res, const MoveInfo *move_infos, size_t num_moves, bool with_san) {
+  Trace::Scope trace("serialize");
+
+  for (size_t i = 0; i < num_moves; i++) {
+      const MoveInfo &m = move_infos[i];
+
+      evbuffer_add_printf(res, "    {\"uci\": \"%s\", ", m.uci);
+      if (with_san) evbuffer_add_printf(res, "\"san\": \"%s\", ", m.san);
+
+      evbuffer_add_printf(res, "\"checkmate\": %s, \"stalemate\": %s, \"variant_win\": %s, \"variant_loss\": %s, \"insufficient_material\": %s, \"zeroing\": %s, ",
+                          m.checkmate ? "true" : "false",
+                          m.stalemate ? "true": "false",
+                          m.variant_win ? "true": "false",
+                          m.variant_loss ? "true": "false",
+                          m.insufficient_material ? "true": "false",
+                          m.zeroing ? "true": "false");
+
+      if (m.has_wdl) evbuffer_add_printf(res, "\"wdl\": %d, ", m.wdl);
+      else evbuffer_add_printf(res, "\"wdl\": null, ");
+
+      if (m.has_dtz) evbuffer_add_printf(res, "\"dtz\": %d", m.dtz);
+      else evbuffer_add_printf(res, "\"dtz\": null");
+
+      if (m.has_dtm) evbuffer_add_printf(res, ", \"dtm\": %d}", m.dtm);
+      else evbuffer_add_printf(res, "}");
+
+      evbuffer_add_printf(res, (i + 1 < num_moves) ? ",\n" : "\n");
+  }
+}
+
+// Writes the JSON body of GET / for pos. st is scratch space for the
+// positions after each move. The move infos are taken from Arena::local().
+void write_moves(Position &pos, const Request &r, StateInfo &st, struct evbuffer *res) {
+  Trace::Scope trace("movegen");
+  const auto legals = MoveList<LEGAL>(pos);
+  trace.stop();
+
+  bool checkmate = legals.size() == 0 && pos.checkers();
+  bool win = variant_win(pos, legals.size());
+  bool loss = variant_loss(pos);
+  bool stalemate = legals.size() == 0 && !checkmate && !win && !loss;
+
+  evbuffer_add_printf(res, "{\n");
+  evbuffer_add_printf(res, "  \"checkmate\": %s,\n", checkmate ? "true" : "false");
+  evbuffer_add_printf(res, "  \"stalemate\": %s,\n", stalemate ? "true": "false");
+  evbuffer_add_printf(res, "  \"variant_win\": %s,\n", win ? "true": "false");
+  evbuffer_add_printf(res, "  \"variant_loss\": %s,\n", loss ? "true": "false");
+  evbuffer_add_printf(res, "  \"moves\": [\n");
+
+  MoveInfo *move_infos = Arena::local().alloc<MoveInfo>(legals.size());
+  size_t num_moves = checkmate ? 0 : probe_moves(pos, legals, r.with_san, r.mode, st, move_infos);
+
+  write_move_infos(res, move_infos, num_moves, r.with_san);
+
+  // End response
+  evbuffer_add_printf(res, "  ]\n");
+  evbuffer_add_printf(res, "}");
+}
@@ -0,0 +1,108 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REQUEST_H_INCLUDED
+#define REQUEST_H_INCLUDED
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <event2/http.h>
+#include <event2/util.h>
+
+#include "position.h"
+#include "probe.h"
+#include "trace.h"
+#include "syzygy/tbprobe.h"
+
+// URL prefix and variant served under it. The single variant builds serve
+// their variant at the root.
+struct Route {
+  const char *prefix;
+  Variant variant;
+};
+
+extern const std::vector<Route> routes;
+
+// Room for the decoded query parameters of a request. Longer queries are
+// rejected with 414 URI Too Long.
+const size_t QUERY_SIZE = 2048;
+const int HTTP_URITOOLONG = 414;
+
+// Query parameters shared by all endpoints and the reply. The decoded query
+// is part of the request, so that the parameters live as long as the request
+// is being handled. Handlers only fill in the reply, which the event loop
+// sends with send_reply(), so that they can run on worker threads. Scratch
+// data of the handler comes from Arena::local(), which is reset after the
+// handler.
+struct Request {
+  const char *uri = "";  // Owned by the evhttp request
+  char query[QUERY_SIZE];
+  size_t query_size = 0;
+
+  const char *fen = nullptr;
+  const char *jsonp = nullptr;
+  bool with_san = true;
+  ProbeMode mode = MODE_FULL;
+  Variant variant;
+
+  // Reply
+  int status = HTTP_OK;
+  const char *reason = "OK";
+  struct evbuffer *body = nullptr;
+
+  // Set while the request is traced, see begin_trace()
+  bool trace_sampled = false;
+  std::unique_ptr<Trace::Recorder> trace;
+  std::unique_ptr<Trace::Scope> trace_scope;
+
+  // For the access log
+  std::chrono::steady_clock::time_point start;
+  uint64_t start_probes = 0;
+  uint64_t num_probes = 0;
+  Tablebases::TableLog tables;
+
+  explicit Request(Variant v) : variant(v) {}
+  Request(struct evhttp_request *req, Variant v);
+  ~Request();
+
+  // The value of the first query parameter named key, ignoring case, or
+  // nullptr
+  const char *param(const char *key) const {
+      for (const char *p = query; p < query + query_size; ) {
+          const char *value = p + strlen(p) + 1;
+          if (!evutil_ascii_strcasecmp(p, key)) return value;
+          p = value + strlen(value) + 1;
+      }
+      return nullptr;
+  }
+};
+
+void write_move_infos(struct evbuffer *res, const MoveInfo *move_infos, size_t num_moves, bool with_san);
+void write_moves(Position &pos, const Request &r, StateInfo &st, struct evbuffer *res);
+
+#endif // #ifndef REQUEST_H_INCLUDED
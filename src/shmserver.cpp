@@ -0,0 +1,167 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <thread>
+
+#include "misc.h"
+#include "shmserver.h"
+
+/// ShmServer::open() creates the segment, replacing a stale one left behind by
+/// a previous server of the same name. slots is rounded up to a power of two.
+
+bool ShmServer::open(const std::string& n, unsigned count) {
+
+  num_slots = 1;
+  while (num_slots < count)
+      num_slots *= 2;
+
+  shm_unlink(n.c_str());
+  int fd = shm_open(n.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+  if (fd < 0)
+      return false;
+
+  size = tb_shm_size(num_slots);
+  void* p = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+      p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+      shm_unlink(n.c_str());
+      return false;
+  }
+
+  // ftruncate() zeroed the segment, so all slots are TB_SHM_FREE
+  tb_shm_header* h = (tb_shm_header*)p;
+  uint32_t cells_offset = (sizeof(tb_shm_header) + 63) & ~63;
+  uint32_t slots_offset = (cells_offset + num_slots * sizeof(tb_shm_cell) + 63) & ~63;
+  cells = (tb_shm_cell*)((char*)p + cells_offset);
+  slots = (tb_shm_slot*)((char*)p + slots_offset);
+  spin = std::thread::hardware_concurrency() > 1 ? TB_SHM_SPIN : 0;
+
+  h->num_slots = num_slots;
+  h->slot_size = sizeof(tb_shm_slot);
+  h->cells_offset = cells_offset;
+  h->slots_offset = slots_offset;
+  for (unsigned i = 0; i < num_slots; ++i)
+      cells[i].sequence = i;
+  h->spin = spin;
+  h->pid = getpid();
+  h->version = TB_SHM_VERSION;
+
+  // Clients check the magic last
+  __atomic_store_n(&h->magic, TB_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  name = n;
+  header = h;
+  requests = 0;
+  return true;
+}
+
+
+/// ShmServer::start() launches the worker threads. They live as long as the
+/// process, like the workers of the HTTP server. With numa they are bound to
+/// the NUMA nodes round-robin.
+
+void ShmServer::start(int workers, bool numa) {
+
+  for (int i = 0; i < workers; ++i)
+      std::thread(&ShmServer::run, this, numa ? i % Numa::nodes() : -1).detach();
+}
+
+
+/// ShmServer::close() removes the name of the segment, so that no new clients
+/// attach. Mapped segments stay valid until the process exits.
+
+void ShmServer::close() {
+
+  if (header)
+      shm_unlink(name.c_str());
+  header = nullptr;
+}
+
+
+void ShmServer::run(int node) {
+
+  if (node >= 0)
+      Numa::bind(node);
+
+  tb_shm_header* h = header;
+
+  while (true)
+  {
+      uint32_t index;
+      if (tb_shm_queue_pop(h, cells, num_slots - 1, &index))
+      {
+          // A client may have queued any index
+          if (index < num_slots)
+              process(&slots[index]);
+          continue;
+      }
+
+      // Spin a little, then sleep on the doorbell. Announcing the sleep before
+      // checking the queue again means a submission in between either is seen
+      // here or changes the doorbell, so that the futex does not block.
+      uint32_t ring = __atomic_load_n(&h->doorbell, __ATOMIC_SEQ_CST);
+      bool found = false;
+      for (uint32_t i = 0; i < spin && !found; ++i)
+          found = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED) != __atomic_load_n(&h->dequeue_pos, __ATOMIC_RELAXED);
+      if (found)
+          continue;
+
+      __atomic_add_fetch(&h->sleepers, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&h->enqueue_pos, __ATOMIC_SEQ_CST) == __atomic_load_n(&h->dequeue_pos, __ATOMIC_SEQ_CST))
+          tb_shm_futex_wait(&h->doorbell, ring, nullptr);
+      __atomic_sub_fetch(&h->sleepers, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+
+void ShmServer::process(tb_shm_slot* slot) {
+
+  // Requests are untrusted: the client may have left the FEN unterminated
+  slot->fen[TB_SHM_FEN_SIZE - 1] = '\0';
+
+  if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != TB_SHM_SUBMITTED)
+      slot->status = TB_ERROR_ARGUMENT;
+  else if (slot->op == TB_SHM_PROBE_FEN)
+      slot->status = tb_probe_fen(slot->variant, slot->fen, slot->mode, &slot->result);
+  else if (slot->op == TB_SHM_PROBE_MOVES)
+      slot->status = tb_probe_moves(slot->variant, slot->fen, slot->mode, slot->moves, TB_SHM_MAX_MOVES);
+  else
+      slot->status = TB_ERROR_ARGUMENT;
+
+  ++requests;
+
+  __atomic_store_n(&slot->state, TB_SHM_DONE, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&slot->waiting, __ATOMIC_SEQ_CST))
+      tb_shm_futex_wake(&slot->state, 1);
+}
@@ -0,0 +1,68 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHMSERVER_H_INCLUDED
+#define SHMSERVER_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#include "tbshm.h"
+
+/// ShmServer answers the probes of local clients through the shared memory
+/// segment described in tbshm.h, bypassing HTTP and the event loop. Worker
+/// threads probe with the C interface of tbapi.h, so tb_open() must have been
+/// called before start().
+
+class ShmServer {
+public:
+  ~ShmServer() { close(); }
+
+  bool open(const std::string& name, unsigned slots);
+  void start(int workers, bool numa = false);
+  void close();
+  bool is_open() const { return header != nullptr; }
+
+  uint64_t served() const { return requests; }
+
+private:
+  void run(int node);
+  void process(tb_shm_slot* slot);
+
+  std::string name;
+  tb_shm_header* header = nullptr;
+  size_t size = 0;
+
+  // The layout as created. Clients can write to the header, so the server
+  // never reads it back from there.
+  uint32_t num_slots = 0;
+  tb_shm_cell* cells = nullptr;
+  tb_shm_slot* slots = nullptr;
+  uint32_t spin = 0;
+  std::atomic<uint64_t> requests;
+};
+
+#endif // #ifndef SHMSERVER_H_INCLUDED
@@ -19,20 +19,26 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cerrno>
+#include <cstddef>   // For offsetof
 #include <cstdint>
+#include <cstdlib>   // For calloc and free
 #include <cstring>   // For std::memset
 #include <deque>
 #include <fstream>
 #include <iostream>
 #include <list>
 #include <sstream>
+#include <thread>
 #include <type_traits>
 
 #include "../bitboard.h"
+#include "../misc.h"
 #include "../movegen.h"
 #include "../position.h"
 #include "../search.h"
 #include "../thread_win32.h"
+#include "../trace.h"
 #include "../types.h"
 
 #include "tbprobe.h"
@@ -51,6 +57,8 @@
 using namespace Tablebases;
 
 int Tablebases::MaxCardinality;
+int Tablebases::VariantMaxCardinality[SUBVARIANT_NB];
+thread_local Tablebases::TableLog* Tablebases::ActiveTableLog = nullptr;
 
 namespace {
 
@@ -336,27 +344,35 @@ static_assert(sizeof(LR) == 3, "LR tree entry must be 3 bytes");
 
 const int TBPIECES = 6;
 
+// The fields used by decompress_pairs() come first, in order of access, and
+// fill exactly one cache line. PairsData of all files of an entry live in one
+// allocation, each followed by its base64[] and symlen[], see do_init().
 struct PairsData {
-    int flags;
-    size_t sizeofBlock;            // Block size in bytes
-    size_t span;                   // About every span values there is a SparseIndex[] entry
-    int blocksNum;                 // Number of blocks in the TB file
-    int maxSymLen;                 // Maximum length in bits of the Huffman symbols
-    int minSymLen;                 // Minimum length in bits of the Huffman symbols
-    Sym* lowestSym;                // lowestSym[l] is the symbol of length l with the lowest value
-    LR* btree;                     // btree[sym] stores the left and right symbols that expand sym
-    uint16_t* blockLength;         // Number of stored positions (minus one) for each block: 1..65536
-    int blockLengthSize;           // Size of blockLength[] table: padded so it's bigger than blocksNum
+    uint8_t flags;
+    uint8_t minSymLen;             // Minimum length in bits of the Huffman symbols
+    uint8_t spanBits;              // About every 2^spanBits values there is a SparseIndex[] entry
+    uint8_t blockBits;             // Block size in bytes is 2^blockBits
     SparseEntry* sparseIndex;      // Partial indices into blockLength[]
-    size_t sparseIndexSize;        // Size of SparseIndex[] table
+    uint16_t* blockLength;         // Number of stored positions (minus one) for each block: 1..65536
     uint8_t* data;                 // Start of Huffman compressed data
-    std::vector<uint64_t> base64;  // base64[l - min_sym_len] is the 64bit-padded lowest symbol of length l
-    std::vector<uint8_t> symlen;   // Number of values (-1) represented by a given Huffman symbol: 1..256
+    uint64_t* base64;              // base64[l - min_sym_len] is the 64bit-padded lowest symbol of length l
+    Sym* lowestSym;                // lowestSym[l] is the symbol of length l with the lowest value
+    uint8_t* symlen;               // Number of values (-1) represented by a given Huffman symbol: 1..256
+    LR* btree;                     // btree[sym] stores the left and right symbols that expand sym
     Piece pieces[TBPIECES];        // Position pieces: the order of pieces defines the groups
     uint64_t groupIdx[TBPIECES+1]; // Start index used for the encoding of the group's pieces
     int groupLen[TBPIECES+1];      // Number of pieces in a given group: KRKN -> (3, 1)
+    int blocksNum;                 // Number of blocks in the TB file
+    int maxSymLen;                 // Maximum length in bits of the Huffman symbols
+    int blockLengthSize;           // Size of blockLength[] table: padded so it's bigger than blocksNum
+    int symlenSize;                // Size of symlen[] and btree[] tables
+    size_t sparseIndexSize;        // Size of SparseIndex[] table
 };
 
+const size_t CacheLineSize = 64;
+
+static_assert(offsetof(PairsData, btree) + sizeof(LR*) <= CacheLineSize, "PairsData hot fields must fit a cache line");
+
 // Helper struct to avoid manually defining entry copy constructor as we
 // should because the default one is not compatible with std::atomic_bool.
 struct Atomic {
@@ -392,6 +408,8 @@ struct DTZEntryPawn {
 struct TBEntry : public Atomic {
     void* baseAddress;
     uint64_t mapping;
+    void* arena;       // PairsData of all files with their base64[] and symlen[]
+    TBEntry** replicas; // Copies in the memory of each NUMA node, see replicate()
     Key key;
     Key key2;
     int pieceCount;
@@ -653,7 +671,9 @@ public:
   void insert(const std::vector<PieceType>& w, const std::vector<PieceType>& b, Variant variant);
 };
 
-HashTable EntryTable;
+// One table per variant, since positions of different variants share the
+// same material keys
+HashTable EntryTable[SUBVARIANT_NB];
 
 class TBFile : public std::ifstream {
 
@@ -686,9 +706,41 @@ public:
         }
     }
 
+#ifndef _WIN32
+    // Read the file into memory backed by huge pages, see large_page_alloc().
+    // Returns nullptr if that fails, so that the file is mapped instead.
+    static void* read_huge(int fd, size_t size, uint64_t* mapping) {
+
+        size_t mapped;
+        uint8_t* mem = (uint8_t*)large_page_alloc(size, &mapped);
+
+        if (!mem)
+            return nullptr;
+
+        for (size_t done = 0; done < size; ) {
+            ssize_t n = pread(fd, mem + done, size - done, done);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0) {
+                large_page_free(mem, mapped);
+                return nullptr;
+            }
+
+            done += n;
+        }
+
+        mprotect(mem, mapped, PROT_READ);
+        *mapping = mapped;
+        return mem;
+    }
+#endif
+
     // Memory map the file and check it. File should be already open and will be
-    // closed after mapping.
-    uint8_t* map(void** baseAddress, uint64_t* mapping, const uint8_t* TB_MAGIC) {
+    // closed after mapping. With huge, the file is read into memory backed by
+    // huge pages instead, if possible.
+    uint8_t* map(void** baseAddress, uint64_t* mapping, const uint8_t* TB_MAGIC, bool huge = false) {
 
         assert(is_open());
 
@@ -703,7 +755,10 @@ public:
 
         fstat(fd, &statbuf);
         *mapping = statbuf.st_size;
-        *baseAddress = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        *baseAddress = huge ? read_huge(fd, statbuf.st_size, mapping) : nullptr;
+
+        if (!*baseAddress)
+            *baseAddress = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
         ::close(fd);
 
         if (*baseAddress == MAP_FAILED) {
@@ -711,6 +766,8 @@ public:
             exit(1);
         }
 #else
+        (void)huge; // Views of file mappings cannot use large pages
+
         HANDLE fd = CreateFile(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
 
@@ -753,7 +810,7 @@ public:
     static void unmap(void* baseAddress, uint64_t mapping) {
 
 #ifndef _WIN32
-        munmap(baseAddress, mapping);
+        munmap(baseAddress, mapping); // Also releases the memory of read_huge()
 #else
         UnmapViewOfFile(baseAddress);
         CloseHandle((HANDLE)mapping);
@@ -807,12 +864,13 @@ WDLEntry::~WDLEntry() {
     if (baseAddress)
         TBFile::unmap(baseAddress, mapping);
 
-    for (int i = 0; i < 2; ++i)
-        if (hasPawns)
-            for (File f = FILE_A; f <= FILE_D; ++f)
-                delete pawnTable.file[i][f].precomp;
-        else
-            delete pieceTable[i].precomp;
+    free(arena);
+
+    if (replicas)
+        for (int n = 0; n < Numa::nodes(); ++n)
+            delete static_cast<WDLEntry*>(replicas[n]);
+
+    free(replicas);
 }
 
 DTZEntry::DTZEntry(const WDLEntry& wdl) {
@@ -839,11 +897,13 @@ DTZEntry::~DTZEntry() {
     if (baseAddress)
         TBFile::unmap(baseAddress, mapping);
 
-    if (hasPawns)
-        for (File f = FILE_A; f <= FILE_D; ++f)
-            delete pawnTable.file[f].precomp;
-    else
-        delete pieceTable.precomp;
+    free(arena);
+
+    if (replicas)
+        for (int n = 0; n < Numa::nodes(); ++n)
+            delete static_cast<DTZEntry*>(replicas[n]);
+
+    free(replicas);
 }
 
 void HashTable::insert(const std::vector<PieceType>& w, const std::vector<PieceType>& b, Variant variant) {
@@ -874,7 +934,8 @@ void HashTable::insert(const std::vector<PieceType>& w, const std::vector<PieceT
     else
         return;
 
-    MaxCardinality = std::max((int)(w.size() + b.size()), MaxCardinality);
+    VariantMaxCardinality[variant] = std::max((int)(w.size() + b.size()), VariantMaxCardinality[variant]);
+    MaxCardinality = std::max(VariantMaxCardinality[variant], MaxCardinality);
 
     wdlTable.emplace_back(code, variant);
     dtzTable.emplace_back(wdlTable.back());
@@ -884,7 +945,7 @@ void HashTable::insert(const std::vector<PieceType>& w, const std::vector<PieceT
 }
 
 // TB tables are compressed with canonical Huffman code. The compressed data is divided into
-// blocks of size d->sizeofBlock, and each block stores a variable number of symbols.
+// blocks of size 2^d->blockBits, and each block stores a variable number of symbols.
 // Each symbol represents either a WDL or a (remapped) DTZ value, or a pair of other symbols
 // (recursively). If you keep expanding the symbols in a block, you end up with up to 65536
 // WDL or DTZ values. Each symbol represents up to 256 values and will correspond after
@@ -898,7 +959,7 @@ void HashTable::insert(const std::vector<PieceType>& w, const std::vector<PieceT
 // Huffman codes is the same for all blocks in the table. A non-symmetric pawnless TB file
 // will have one table for wtm and one for btm, a TB file with pawns will have tables per
 // file a,b,c,d also in this case one set for wtm and one for btm.
-int decompress_pairs(PairsData* d, uint64_t idx) {
+DISPATCH_CLONES int decompress_pairs(PairsData* d, uint64_t idx) {
 
     // Special case where all table positions store the same value
     if (d->flags & TBFlag::SingleValue)
@@ -916,10 +977,13 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
     // that stores the blockLength[] index and the offset within that block of the value
     // with index I(k), where:
     //
-    //       I(k) = k * d->span + d->span / 2      (1)
+    //       I(k) = k * span + span / 2      (1)
+    //
+    // where span = 2^d->spanBits.
+    const uint64_t span = 1ULL << d->spanBits;
 
     // First step is to get the 'k' of the I(k) nearest to our idx, using definition (1)
-    uint32_t k = idx / d->span;
+    uint32_t k = idx >> d->spanBits;
 
     // Then we read the corresponding SparseIndex[] entry
     uint32_t block = number<uint32_t, LittleEndian>(&d->sparseIndex[k].block);
@@ -927,10 +991,10 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
 
     // Now compute the difference idx - I(k). From definition of k we know that
     //
-    //       idx = k * d->span + idx % d->span    (2)
+    //       idx = k * span + idx % span    (2)
     //
     // So from (1) and (2) we can compute idx - I(K):
-    int diff = idx % d->span - d->span / 2;
+    int diff = int(idx & (span - 1)) - int(span / 2);
 
     // Sum the above to offset to find the offset corresponding to our idx
     offset += diff;
@@ -944,7 +1008,7 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
         offset -= d->blockLength[block++] + 1;
 
     // Finally, we find the start address of our block of canonical Huffman symbols
-    uint32_t* ptr = (uint32_t*)(d->data + block * d->sizeofBlock);
+    uint32_t* ptr = (uint32_t*)(d->data + ((size_t)block << d->blockBits));
 
     // Read the first 64 bits in our block, this is a (truncated) sequence of
     // unknown number of symbols of unknown length but we know the first one
@@ -1060,7 +1124,7 @@ int map_score(DTZEntry* entry, File f, int value, WDLScore wdl) {
 //      idx = Binomial[1][s1] + Binomial[2][s2] + ... + Binomial[k][sk]
 //
 template<typename Entry, typename T = typename Ret<Entry>::type>
-T do_probe_table(const Position& pos, Entry* entry, WDLScore wdl, ProbeState* result) {
+DISPATCH_CLONES T do_probe_table(const Position& pos, Entry* entry, WDLScore wdl, ProbeState* result) {
 
     const bool IsWDL = std::is_same<Entry, WDLEntry>::value;
 
@@ -1455,8 +1519,9 @@ uint8_t* set_sizes(PairsData* d, uint8_t* data) {
     d->flags = *data++;
 
     if (d->flags & TBFlag::SingleValue) {
-        d->blocksNum = d->blockLengthSize = 0;
-        d->span = d->sparseIndexSize = 0; // Broken MSVC zero-init
+        d->blocksNum = d->blockLengthSize = d->symlenSize = 0;
+        d->spanBits = d->blockBits = 0;
+        d->sparseIndexSize = 0; // Broken MSVC zero-init
         d->minSymLen = *data++; // Here we store the single value
         return data;
     }
@@ -1465,9 +1530,9 @@ uint8_t* set_sizes(PairsData* d, uint8_t* data) {
     // element stores the biggest index that is the tb size.
     uint64_t tbSize = d->groupIdx[std::find(d->groupLen, d->groupLen + 7, 0) - d->groupLen];
 
-    d->sizeofBlock = 1ULL << *data++;
-    d->span = 1ULL << *data++;
-    d->sparseIndexSize = (tbSize + d->span - 1) / d->span; // Round up
+    d->blockBits = *data++;
+    d->spanBits = *data++;
+    d->sparseIndexSize = (tbSize + (1ULL << d->spanBits) - 1) >> d->spanBits; // Round up
     int padding = number<uint8_t, LittleEndian>(data++);
     d->blocksNum = number<uint32_t, LittleEndian>(data); data += sizeof(uint32_t);
     d->blockLengthSize = d->blocksNum + padding; // Padded to ensure SparseIndex[]
@@ -1475,7 +1540,38 @@ uint8_t* set_sizes(PairsData* d, uint8_t* data) {
     d->maxSymLen = *data++;
     d->minSymLen = *data++;
     d->lowestSym = (Sym*)data;
-    d->base64.resize(d->maxSymLen - d->minSymLen + 1);
+    data += (d->maxSymLen - d->minSymLen + 1) * sizeof(Sym);
+    d->symlenSize = number<uint16_t, LittleEndian>(data); data += sizeof(uint16_t);
+    d->btree = (LR*)data;
+
+    return data + d->symlenSize * sizeof(LR) + (d->symlenSize & 1);
+}
+
+// Size of base64[] and symlen[] in bytes
+size_t symbols_size(const PairsData* d) {
+
+    if (d->flags & TBFlag::SingleValue)
+        return 0;
+
+    return (d->maxSymLen - d->minSymLen + 1) * sizeof(uint64_t) + d->symlenSize;
+}
+
+// Size of d with its base64[] and symlen[], padded to a cache line
+size_t arena_size(const PairsData* d) {
+
+    return (sizeof(PairsData) + symbols_size(d) + CacheLineSize - 1) & ~(CacheLineSize - 1);
+}
+
+// Compute base64[] and symlen[] into the zeroed memory right after d
+void set_symbols(PairsData* d) {
+
+    if (d->flags & TBFlag::SingleValue)
+        return;
+
+    const int base64Size = d->maxSymLen - d->minSymLen + 1;
+
+    d->base64 = (uint64_t*)(d + 1);
+    d->symlen = (uint8_t*)(d->base64 + base64Size);
 
     // The canonical code is ordered such that longer symbols (in terms of
     // the number of bits of their Huffman code) have lower numeric value,
@@ -1483,7 +1579,7 @@ uint8_t* set_sizes(PairsData* d, uint8_t* data) {
     // Starting from this we compute a base64[] table indexed by symbol length
     // and containing 64 bit values so that d->base64[i] >= d->base64[i+1].
     // See http://www.eecs.harvard.edu/~michaelm/E210/huffman.pdf
-    for (int i = d->base64.size() - 2; i >= 0; --i) {
+    for (int i = base64Size - 2; i >= 0; --i) {
         d->base64[i] = (d->base64[i + 1] + number<Sym, LittleEndian>(&d->lowestSym[i])
                                          - number<Sym, LittleEndian>(&d->lowestSym[i + 1])) / 2;
 
@@ -1494,25 +1590,19 @@ uint8_t* set_sizes(PairsData* d, uint8_t* data) {
     // than d->base64[i+1] and given the above assert condition, we ensure that
     // d->base64[i] >= d->base64[i+1]. Moreover for any symbol s64 of length i
     // and right-padded to 64 bits holds d->base64[i-1] >= s64 >= d->base64[i].
-    for (size_t i = 0; i < d->base64.size(); ++i)
+    for (int i = 0; i < base64Size; ++i)
         d->base64[i] <<= 64 - i - d->minSymLen; // Right-padding to 64 bits
 
-    data += d->base64.size() * sizeof(Sym);
-    d->symlen.resize(number<uint16_t, LittleEndian>(data)); data += sizeof(uint16_t);
-    d->btree = (LR*)data;
-
     // The comrpession scheme used is "Recursive Pairing", that replaces the most
     // frequent adjacent pair of symbols in the source message by a new symbol,
     // reevaluating the frequencies of all of the symbol pairs with respect to
     // the extended alphabet, and then repeating the process.
     // See http://www.larsson.dogma.net/dcc99.pdf
-    std::vector<bool> visited(d->symlen.size());
+    std::vector<bool> visited(d->symlenSize);
 
-    for (Sym sym = 0; sym < d->symlen.size(); ++sym)
+    for (Sym sym = 0; sym < d->symlenSize; ++sym)
         if (!visited[sym])
             d->symlen[sym] = set_symlen(d, sym, visited);
-
-    return data + d->symlen.size() * sizeof(LR) + (d->symlen.size() & 1);
 }
 
 template<typename T>
@@ -1540,6 +1630,7 @@ void do_init(Entry& e, T& p, uint8_t* data) {
     const bool IsWDL = std::is_same<Entry, WDLEntry>::value;
 
     PairsData* d;
+    PairsData pairs[2][4] = {}; // Until the size of the arena is known
 
     enum { Split = 1, HasPawns = 2 };
 
@@ -1558,7 +1649,7 @@ void do_init(Entry& e, T& p, uint8_t* data) {
     for (File f = FILE_A; f <= MaxFile; ++f) {
 
         for (int i = 0; i < Sides; i++)
-            item(p, i, f).precomp = new PairsData();
+            item(p, i, f).precomp = &pairs[i][f];
 
         int order[][2] = { { *data & 0xF, pp ? *(data + 1) & 0xF : 0xF },
                            { *data >>  4, pp ? *(data + 1) >>  4 : 0xF } };
@@ -1584,6 +1675,32 @@ void do_init(Entry& e, T& p, uint8_t* data) {
 #endif
         }
 
+    // Now move the PairsData of all files into a single allocation, each one
+    // followed by its base64[] and symlen[], so that a probe only touches a
+    // few consecutive cache lines besides the compressed data.
+    size_t size = 0;
+    for (File f = FILE_A; f <= MaxFile; ++f)
+        for (int i = 0; i < Sides; i++)
+            size += arena_size(item(p, i, f).precomp);
+
+    e.arena = calloc(size + CacheLineSize - 1, 1);
+
+    if (!e.arena) {
+        std::cerr << "Failed to allocate " << size << " bytes for tablebase entry" << std::endl;
+        exit(1);
+    }
+
+    uint8_t* arena = (uint8_t*)((uintptr_t(e.arena) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+
+    for (File f = FILE_A; f <= MaxFile; ++f)
+        for (int i = 0; i < Sides; i++) {
+            d = (PairsData*)arena;
+            *d = *item(p, i, f).precomp;
+            item(p, i, f).precomp = d;
+            set_symbols(d);
+            arena += arena_size(d);
+        }
+
     if (!IsWDL)
         data = set_dtz_map(e, p, data, MaxFile);
 
@@ -1603,12 +1720,12 @@ void do_init(Entry& e, T& p, uint8_t* data) {
         for (int i = 0; i < Sides; i++) {
             data = (uint8_t*)(((uintptr_t)data + 0x3F) & ~0x3F); // 64 byte alignment
             (d = item(p, i, f).precomp)->data = data;
-            data += d->blocksNum * d->sizeofBlock;
+            data += (size_t)d->blocksNum << d->blockBits;
         }
 }
 
 template<typename Entry>
-void* init(Entry& e, const Position& pos) {
+void* init(Entry& e, const Position& pos, bool huge = false) {
 
     const bool IsWDL = std::is_same<Entry, WDLEntry>::value;
 
@@ -1863,6 +1980,8 @@ void* init(Entry& e, const Position& pos) {
 
     fname = e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w;
 
+    Trace::Scope trace(IsWDL ? "init_wdl" : "init_dtz", fname.c_str());
+
     const char** Suffixes = IsWDL ? WdlSuffixes : DtzSuffixes;
     const char** PawnlessSuffixes = IsWDL ? PawnlessWdlSuffixes : PawnlessDtzSuffixes;
 
@@ -1870,17 +1989,17 @@ void* init(Entry& e, const Position& pos) {
     TBFile file(fname + Suffixes[e.variant]);
 
     if (file.is_open())
-        data = file.map(&e.baseAddress, &e.mapping, TB_MAGIC[e.variant][IsWDL]);
+        data = file.map(&e.baseAddress, &e.mapping, TB_MAGIC[e.variant][IsWDL], huge);
     else if (fname.find("P") == std::string::npos && PawnlessSuffixes[e.variant]) {
         TBFile pawnlessFile(fname + PawnlessSuffixes[e.variant]);
-        data = pawnlessFile.map(&e.baseAddress, &e.mapping, PAWNLESS_TB_MAGIC[e.variant][IsWDL]);
+        data = pawnlessFile.map(&e.baseAddress, &e.mapping, PAWNLESS_TB_MAGIC[e.variant][IsWDL], huge);
     }
 
     if (data) {
         e.hasPawns ? do_init(e, e.pawnTable, data) : do_init(e, e.pieceTable, data);
 
 #ifdef ANTI
-        if (!e.hasPawns) {
+        if (!e.hasPawns && main_variant(e.variant) == ANTI_VARIANT) {
             // Recalculate table key.
             std::string w2, b2;
             for (int i = 0; i < e.pieceCount; i++) {
@@ -1917,6 +2036,31 @@ T result_to_score(Value value) {
         return T(WDLDraw);
 }
 
+// Adds a table to the log, named like init() names the file
+void log_table(TableLog& log, Key key, const Position& pos) {
+
+    log.lookups++;
+
+    for (int i = 0; i < log.count; ++i)
+        if (log.keys[i] == key)
+            return;
+
+    if (log.count == TableLog::Capacity)
+        return;
+
+    std::string w, b;
+    for (PieceType pt = KING; pt >= PAWN; --pt) {
+        w += std::string(popcount(pos.pieces(WHITE, pt)), PieceToChar[pt]);
+        b += std::string(popcount(pos.pieces(BLACK, pt)), PieceToChar[pt]);
+    }
+    std::string name = key == pos.material_key() ? w + 'v' + b : b + 'v' + w;
+
+    log.keys[log.count] = key;
+    strncpy(log.names[log.count], name.c_str(), sizeof(log.names[0]) - 1);
+    log.names[log.count][sizeof(log.names[0]) - 1] = '\0';
+    log.count++;
+}
+
 template<typename E, typename T = typename Ret<E>::type>
 T probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
 
@@ -1934,7 +2078,16 @@ T probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
     if (!(pos.pieces() ^ pos.pieces(KING)))
         return T(WDLDraw); // KvK
 
-    E* entry = EntryTable.get<E>(pos.material_key());
+    Trace::Scope trace("probe_table", std::is_same<E, WDLEntry>::value ? "wdl" : "dtz");
+
+    E* entry = EntryTable[pos.subvariant()].get<E>(pos.material_key());
+
+    // Threads bound to a NUMA node probe the copy in the memory of their node
+    if (entry && entry->replicas && Numa::node() >= 0 && entry->replicas[Numa::node()])
+        entry = static_cast<E*>(entry->replicas[Numa::node()]);
+
+    if (ActiveTableLog && entry)
+        log_table(*ActiveTableLog, entry->key, pos);
 
     if (!entry || !init(*entry, pos))
         return *result = FAIL, T();
@@ -1942,20 +2095,24 @@ T probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
     return do_probe_table(pos, entry, wdl, result);
 }
 
+// The recursive probes below play their moves on st, the next free state of
+// the thread's StateStack, and pass st + 1 on.
+
 #ifdef ANTI
 template <bool Threats = false>
-WDLScore sprobe_ab(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* result);
+WDLScore sprobe_ab(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* result, StateInfo* st);
 
-WDLScore sprobe_captures(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* result) {
+WDLScore sprobe_captures(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* result, StateInfo* st) {
+
+    assert(StateStack::local().contains(st));
 
     auto moveList = MoveList<CAPTURES>(pos);
-    StateInfo st;
 
     *result = OK;
 
     for (const Move& move : moveList) {
-        pos.do_move(move, st);
-        WDLScore v = -sprobe_ab(pos, -beta, -alpha, result);
+        pos.do_move(move, *st);
+        WDLScore v = -sprobe_ab(pos, -beta, -alpha, result, st + 1);
         pos.undo_move(move);
 
         if (*result == FAIL)
@@ -1975,13 +2132,13 @@ WDLScore sprobe_captures(Position &pos, WDLScore alpha, WDLScore beta, ProbeStat
 }
 
 template<bool Threats>
-WDLScore sprobe_ab(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* result) {
+WDLScore sprobe_ab(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* result, StateInfo* st) {
 
     WDLScore v;
     bool threatFound = false;
 
     if (popcount(pos.pieces(~pos.side_to_move())) > 1) {
-        v = sprobe_captures(pos, alpha, beta, result);
+        v = sprobe_captures(pos, alpha, beta, result, st);
         if (*result == ZEROING_BEST_MOVE || *result == FAIL)
             return v;
     } else {
@@ -1993,12 +2150,13 @@ WDLScore sprobe_ab(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* res
     }
 
     if (Threats || popcount(pos.pieces()) >= 6) {
-        StateInfo st;
+        assert(StateStack::local().contains(st));
+
         auto moveList = MoveList<LEGAL>(pos);
 
         for (const Move& move : moveList) {
-            pos.do_move(move, st);
-            v = -sprobe_captures(pos, -beta, -alpha, result);
+            pos.do_move(move, *st);
+            v = -sprobe_captures(pos, -beta, -alpha, result, st + 1);
             pos.undo_move(move);
 
             if (*result == FAIL)
@@ -2044,15 +2202,16 @@ WDLScore sprobe_ab(Position &pos, WDLScore alpha, WDLScore beta, ProbeState* res
 // where the best move is an ep-move (even if losing). So in all these cases set
 // the state to ZEROING_BEST_MOVE.
 template<bool CheckZeroingMoves = false>
-WDLScore search(Position& pos, ProbeState* result) {
+WDLScore search(Position& pos, ProbeState* result, StateInfo* st) {
 
 #ifdef ANTI
     if (pos.is_anti())
-        return sprobe_ab<CheckZeroingMoves>(pos, WDLLoss, WDLWin, result);
+        return sprobe_ab<CheckZeroingMoves>(pos, WDLLoss, WDLWin, result, st);
 #endif
 
+    assert(StateStack::local().contains(st));
+
     WDLScore value, bestValue = WDLLoss;
-    StateInfo st;
 
     auto moveList = MoveList<LEGAL>(pos);
     size_t totalCount = moveList.size(), moveCount = 0;
@@ -2065,8 +2224,8 @@ WDLScore search(Position& pos, ProbeState* result) {
 
         moveCount++;
 
-        pos.do_move(move, st);
-        value = -search(pos, result);
+        pos.do_move(move, *st);
+        value = -search(pos, result, st + 1);
         pos.undo_move(move);
 
         if (*result == FAIL)
@@ -2110,12 +2269,66 @@ WDLScore search(Position& pos, ProbeState* result) {
     return *result = OK, value;
 }
 
+// Collects the compressed tables of an entry, see Tablebases::pairs_tables()
+template<typename E, typename T>
+void add_pairs_tables(E& e, T& p, std::vector<PairsTable>& tables) {
+
+    const bool IsWDL = std::is_same<E, WDLEntry>::value;
+
+    for (int f = 0; f < (e.hasPawns ? 4 : 1); ++f)
+        for (int stm = 0; stm < (IsWDL ? 2 : 1); ++stm)
+        {
+            PairsData* d = item(p, stm, f).precomp;
+            if (!d)
+                continue;
+
+            PairsTable t;
+            t.label = std::string(IsWDL ? "wdl" : "dtz")
+                    + (IsWDL ? (stm ? " btm" : " wtm") : "")
+                    + (e.hasPawns ? std::string(" file ") + char('a' + f) : "");
+            t.pairs = d;
+            t.size = 0;
+            t.blockSize = 1 << d->blockBits;
+            t.metadataSize = sizeof(PairsData) + symbols_size(d);
+            t.minSymLen = d->minSymLen;
+            t.maxSymLen = d->maxSymLen;
+            t.spanBits = d->spanBits;
+            t.symlenSize = d->symlenSize;
+            t.lowestSym = (const uint8_t*)d->lowestSym;
+            t.btree = (const uint8_t*)d->btree;
+            t.sparseIndex = (const uint8_t*)d->sparseIndex;
+            t.blockLength = d->blockLength;
+            t.data = d->data;
+
+            if (!(d->flags & TBFlag::SingleValue))
+                for (int b = 0; b < d->blocksNum; ++b)
+                    t.size += d->blockLength[b] + 1;
+
+            tables.push_back(t);
+        }
+}
+
 } // namespace
 
 void Tablebases::init(const std::string& paths, Variant variant) {
 
-    EntryTable.clear();
+    for (Variant v = CHESS_VARIANT; v < SUBVARIANT_NB; ++v)
+        EntryTable[v].clear(), VariantMaxCardinality[v] = 0;
     MaxCardinality = 0;
+
+    add(paths, variant);
+}
+
+/// Tablebases::add() loads the tables of another variant, keeping the ones
+/// already loaded. All variants share the same search paths.
+
+void Tablebases::add(const std::string& paths, Variant variant) {
+
+    EntryTable[variant].clear();
+    VariantMaxCardinality[variant] = 0;
+    MaxCardinality = 0;
+    for (Variant v = CHESS_VARIANT; v < SUBVARIANT_NB; ++v)
+        MaxCardinality = std::max(VariantMaxCardinality[v], MaxCardinality);
     TBFile::Paths = paths;
 
     if (paths.empty() || paths == "<empty>")
@@ -2229,73 +2442,167 @@ void Tablebases::init(const std::string& paths, Variant variant) {
     if (main_variant(variant) == ANTI_VARIANT) {
         for (PieceType p1 = PAWN; p1 <= KING; ++p1) {
             for (PieceType p2 = PAWN; p2 <= p1; ++p2) {
-                EntryTable.insert({p1}, {p2}, variant);
+                EntryTable[variant].insert({p1}, {p2}, variant);
 
                 for (PieceType p3 = PAWN; p3 <= KING; ++p3)
-                    EntryTable.insert({p1, p2}, {p3}, variant);
+                    EntryTable[variant].insert({p1, p2}, {p3}, variant);
 
                 for (PieceType p3 = PAWN; p3 <= p2; ++p3) {
                     for (PieceType p4 = PAWN; p4 <= KING; ++p4) {
-                        EntryTable.insert({p1, p2, p3}, {p4}, variant);
+                        EntryTable[variant].insert({p1, p2, p3}, {p4}, variant);
 
                         for (PieceType p5 = PAWN; p5 <= p4; ++p5)
-                            EntryTable.insert({p1, p2, p3}, {p4, p5}, variant);
+                            EntryTable[variant].insert({p1, p2, p3}, {p4, p5}, variant);
                     }
 
                     for (PieceType p4 = PAWN; p4 <= p3; ++p4) {
                         for (PieceType p5 = PAWN; p5 <= KING; ++p5) {
-                            EntryTable.insert({p1, p2, p3, p4}, {p5}, variant);
+                            EntryTable[variant].insert({p1, p2, p3, p4}, {p5}, variant);
 
                             for (PieceType p6 = PAWN; p6 <= p5; ++p6)
-                                EntryTable.insert({p1, p2, p3, p4}, {p5, p6}, variant);
+                                EntryTable[variant].insert({p1, p2, p3, p4}, {p5, p6}, variant);
                         }
 
                         for (PieceType p5 = PAWN; p5 <= p4; ++p5)
                             for (PieceType p6 = PAWN; p6 <= KING; ++p6)
-                                EntryTable.insert({p1, p2, p3, p4, p5}, {p6}, variant);
+                                EntryTable[variant].insert({p1, p2, p3, p4, p5}, {p6}, variant);
                     }
 
                     for (PieceType p4 = PAWN; p4 <= p1; ++p4)
                         for (PieceType p5 = PAWN; p5 <= (p1 == p4 ? p2 : p4); ++p5)
                             for (PieceType p6 = PAWN; p6 <= ((p1 == p4 && p5 == p2) ? p3 : p5); ++p6)
-                                EntryTable.insert({p1, p2, p3}, {p4, p5, p6}, variant);
+                                EntryTable[variant].insert({p1, p2, p3}, {p4, p5, p6}, variant);
                 }
 
                 for (PieceType p3 = PAWN; p3 <= p1; ++p3)
                     for (PieceType p4 = PAWN; p4 <= (p1 == p3 ? p2 : p3); ++p4)
-                        EntryTable.insert({p1, p2}, {p3, p4}, variant);
+                        EntryTable[variant].insert({p1, p2}, {p3, p4}, variant);
             }
         }
     } else
 #endif
 
     for (PieceType p1 = PAWN; p1 < KING; ++p1) {
-        EntryTable.insert({KING, p1}, {KING}, variant);
+        EntryTable[variant].insert({KING, p1}, {KING}, variant);
 
         for (PieceType p2 = PAWN; p2 <= p1; ++p2) {
-            EntryTable.insert({KING, p1, p2}, {KING}, variant);
-            EntryTable.insert({KING, p1}, {KING, p2}, variant);
+            EntryTable[variant].insert({KING, p1, p2}, {KING}, variant);
+            EntryTable[variant].insert({KING, p1}, {KING, p2}, variant);
 
             for (PieceType p3 = PAWN; p3 < KING; ++p3)
-                EntryTable.insert({KING, p1, p2}, {KING, p3}, variant);
+                EntryTable[variant].insert({KING, p1, p2}, {KING, p3}, variant);
 
             for (PieceType p3 = PAWN; p3 <= p2; ++p3) {
-                EntryTable.insert({KING, p1, p2, p3}, {KING}, variant);
+                EntryTable[variant].insert({KING, p1, p2, p3}, {KING}, variant);
 
                 for (PieceType p4 = PAWN; p4 <= p3; ++p4)
-                    EntryTable.insert({KING, p1, p2, p3, p4}, {KING}, variant);
+                    EntryTable[variant].insert({KING, p1, p2, p3, p4}, {KING}, variant);
 
                 for (PieceType p4 = PAWN; p4 < KING; ++p4)
-                    EntryTable.insert({KING, p1, p2, p3}, {KING, p4}, variant);
+                    EntryTable[variant].insert({KING, p1, p2, p3}, {KING, p4}, variant);
             }
 
             for (PieceType p3 = PAWN; p3 <= p1; ++p3)
                 for (PieceType p4 = PAWN; p4 <= (p1 == p3 ? p2 : p3); ++p4)
-                    EntryTable.insert({KING, p1, p2}, {KING, p3, p4}, variant);
+                    EntryTable[variant].insert({KING, p1, p2}, {KING, p3, p4}, variant);
         }
     }
 
-    sync_cout << "info string Found " << EntryTable.size() << " tablebases" << sync_endl;
+#ifndef TBAPI_LIBRARY // Not on the stdout of the process that loaded the library
+    sync_cout << "info string Found " << EntryTable[variant].size() << " tablebases" << sync_endl;
+#endif
+}
+
+/// Tablebases::load_huge() reads the WDL and DTZ tables of the material given
+/// like "KRPvKR" into memory backed by huge pages, instead of mapping them on
+/// first use. Hot tables then take far fewer TLB entries. Must be called before
+/// the tables are probed. Returns the number of tables found, 0 if there are
+/// no such tables.
+
+int Tablebases::load_huge(const std::string& code, Variant variant) {
+
+    if (   code.length() >= 9
+        || std::count(code.begin(), code.end(), 'v') != 1
+        || code.find_first_not_of("KQRBNPv") != std::string::npos)
+        return 0;
+
+    StateInfo st;
+    Position pos;
+    pos.set(code, WHITE, variant, &st);
+
+    WDLEntry* wdl = EntryTable[pos.subvariant()].get<WDLEntry>(pos.material_key());
+    DTZEntry* dtz = EntryTable[pos.subvariant()].get<DTZEntry>(pos.material_key());
+
+    return   (wdl && init(*wdl, pos, true))
+           + (dtz && init(*dtz, pos, true));
+}
+
+/// Tablebases::replicate() reads a copy of the WDL and DTZ tables of the given
+/// material into the memory of each NUMA node, from a thread bound to that node,
+/// so that the pages are allocated there. Threads bound with Numa::bind() then
+/// probe the copy of their node and the original stays mapped lazily for other
+/// threads. Call it instead of load_huge(), before the tables are probed, so
+/// that there is no extra copy of the original. Returns the number of nodes
+/// with a copy.
+
+int Tablebases::replicate(const std::string& code, Variant variant) {
+
+    if (   Numa::nodes() < 2
+        || code.length() >= 9
+        || std::count(code.begin(), code.end(), 'v') != 1
+        || code.find_first_not_of("KQRBNPv") != std::string::npos)
+        return 0;
+
+    StateInfo st;
+    Position pos;
+    pos.set(code, WHITE, variant, &st);
+
+    WDLEntry* wdl = EntryTable[pos.subvariant()].get<WDLEntry>(pos.material_key());
+    DTZEntry* dtz = EntryTable[pos.subvariant()].get<DTZEntry>(pos.material_key());
+
+    if (!wdl || wdl->replicas)
+        return 0;
+
+    // Name the copies like the entry, so that they open the same files even if
+    // the sides of the code are swapped, like "KRvKRP".
+    std::string name = code;
+    if (wdl->key != pos.material_key()) {
+        size_t v = code.find('v');
+        name = code.substr(v + 1) + 'v' + code.substr(0, v);
+    }
+
+    wdl->replicas = (TBEntry**)calloc(Numa::nodes(), sizeof(TBEntry*));
+    dtz->replicas = (TBEntry**)calloc(Numa::nodes(), sizeof(TBEntry*));
+
+    int replicated = 0;
+
+    for (int n = 0; n < Numa::nodes(); ++n)
+        std::thread([&, n] {
+
+            if (!Numa::bind(n))
+                return;
+
+            StateInfo st2;
+            Position pos2;
+            pos2.set(name, WHITE, variant, &st2);
+
+            WDLEntry* w = new WDLEntry(name, variant);
+            DTZEntry* d = new DTZEntry(*w);
+
+            if (!init(*w, pos2, true))
+            {
+                delete d;
+                delete w;
+                return;
+            }
+
+            init(*d, pos2, true);
+            wdl->replicas[n] = w;
+            dtz->replicas[n] = d;
+            replicated++;
+        }).join();
+
+    return replicated;
 }
 
 // Probe the WDL table for a particular position.
@@ -2308,8 +2615,12 @@ void Tablebases::init(const std::string& paths, Variant variant) {
 //  2 : win
 WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+    Trace::Scope trace("probe_wdl");
+
+    StateStack& stack = StateStack::local();
+    assert(stack.top <= MAX_PLY); // MAX_PROBE_PLY states left for the search
     *result = OK;
-    return search(pos, result);
+    return search(pos, result, stack.states + stack.top);
 }
 
 // Probe the DTZ table for a particular position.
@@ -2337,10 +2648,12 @@ WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 //
 // In short, if a move is available resulting in dtz + 50-move-counter <= 99,
 // then do not accept moves leading to dtz + 50-move-counter == 100.
-int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
+static int probe_dtz(Position& pos, ProbeState* result, StateInfo* st) {
+
+    Trace::Scope trace("probe_dtz");
 
     *result = OK;
-    WDLScore wdl = search<true>(pos, result);
+    WDLScore wdl = search<true>(pos, result, st);
 
     if (*result == FAIL || wdl == WDLDraw) // DTZ tables don't store draws
         return 0;
@@ -2351,7 +2664,7 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
         return dtz_before_zeroing(wdl);
 
 #ifdef ANTI
-    if (pos.pieces(pos.side_to_move()) == pos.pieces(pos.side_to_move(), PAWN))
+    if (pos.is_anti() && pos.pieces(pos.side_to_move()) == pos.pieces(pos.side_to_move(), PAWN))
         return dtz_before_zeroing(wdl);
 
     if (*result == THREAT && wdl > WDLDraw)
@@ -2368,21 +2681,20 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
 
     // DTZ stores results for the other side, so we need to do a 1-ply search and
     // find the winning move that minimizes DTZ.
-    StateInfo st;
     int minDTZ = 0xFFFF;
 
     for (const Move& move : MoveList<LEGAL>(pos))
     {
         bool zeroing = pos.capture(move) || type_of(pos.moved_piece(move)) == PAWN;
 
-        pos.do_move(move, st);
+        pos.do_move(move, *st);
 
         // For zeroing moves we want the dtz of the move _before_ doing it,
         // otherwise we will get the dtz of the next move sequence. Search the
         // position after the move to get the score sign (because even in a
         // winning position we could make a losing capture or going for a draw).
-        dtz = zeroing ? -dtz_before_zeroing(search(pos, result))
-                      : -probe_dtz(pos, result);
+        dtz = zeroing ? -dtz_before_zeroing(search(pos, result, st + 1))
+                      : -probe_dtz(pos, result, st + 1);
 
         pos.undo_move(move);
 
@@ -2405,6 +2717,13 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
     return minDTZ == 0xFFFF ? -1 : minDTZ;
 }
 
+int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
+
+    StateStack& stack = StateStack::local();
+    assert(stack.top <= MAX_PLY); // MAX_PROBE_PLY states left for the search
+    return probe_dtz(pos, result, stack.states + stack.top);
+}
+
 // Check whether there has been at least one repetition of positions
 // since the last capture or pawn move.
 static int has_repeated(StateInfo *st)
@@ -2473,12 +2792,12 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, Value&
     if (result == FAIL)
         return false;
 
-    StateInfo st;
+    StateFrame st(1);
 
     // Probe each move
     for (size_t i = 0; i < rootMoves.size(); ++i) {
         Move move = rootMoves[i].pv[0];
-        pos.do_move(move, st);
+        pos.do_move(move, st[0]);
         int v = 0;
 
         if (pos.checkers() && dtz > 0) {
@@ -2489,7 +2808,7 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, Value&
         }
 
         if (!v) {
-            if (st.rule50 != 0) {
+            if (st[0].rule50 != 0) {
                 v = -probe_dtz(pos, &result);
 
                 if (v > 0)
@@ -2512,7 +2831,7 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, Value&
 
     // Obtain 50-move counter for the root position.
     // In Stockfish there seems to be no clean way, so we do it like this:
-    int cnt50 = st.previous ? st.previous->rule50 : 0;
+    int cnt50 = st[0].previous ? st[0].previous->rule50 : 0;
 
     // Use 50-move counter to determine whether the root position is
     // won, lost or drawn.
@@ -2551,7 +2870,7 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, Value&
 
         // If the current phase has not seen repetitions, then try all moves
         // that stay safely within the 50-move budget, if there are any.
-        if (!has_repeated(st.previous) && best + cnt50 <= 99)
+        if (!has_repeated(st[0].previous) && best + cnt50 <= 99)
             max = 99 - cnt50;
 
         for (size_t i = 0; i < rootMoves.size(); ++i) {
@@ -2635,14 +2954,14 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, Val
 
     score = WDL_to_value[wdl + 2];
 
-    StateInfo st;
+    StateFrame st(1);
 
     int best = WDLLoss;
 
     // Probe each move
     for (size_t i = 0; i < rootMoves.size(); ++i) {
         Move move = rootMoves[i].pv[0];
-        pos.do_move(move, st);
+        pos.do_move(move, st[0]);
         WDLScore v = -Tablebases::probe_wdl(pos, &result);
         pos.undo_move(move);
 
@@ -2666,3 +2985,61 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, Val
 
     return true;
 }
+
+/// Tablebases::pairs_tables() appends the compressed tables of the WDL and DTZ
+/// files of the material of pos, mapping them if needed. Returns false if there
+/// is no WDL file. Only meant for benchmarks.
+
+bool Tablebases::pairs_tables(const Position& pos, std::vector<PairsTable>& tables) {
+
+    WDLEntry* wdl = EntryTable[pos.subvariant()].get<WDLEntry>(pos.material_key());
+    if (!wdl || !init(*wdl, pos))
+        return false;
+
+    if (wdl->hasPawns)
+        add_pairs_tables(*wdl, wdl->pawnTable, tables);
+    else
+        add_pairs_tables(*wdl, wdl->pieceTable, tables);
+
+    DTZEntry* dtz = EntryTable[pos.subvariant()].get<DTZEntry>(pos.material_key());
+    if (dtz && init(*dtz, pos))
+    {
+        if (dtz->hasPawns)
+            add_pairs_tables(*dtz, dtz->pawnTable, tables);
+        else
+            add_pairs_tables(*dtz, dtz->pieceTable, tables);
+    }
+
+    return true;
+}
+
+/// Tablebases::decompress() looks up the value at index idx of a table from
+/// pairs_tables()
+
+int Tablebases::decompress(const PairsTable& table, uint64_t idx) {
+    return decompress_pairs(static_cast<PairsData*>(table.pairs), idx);
+}
+
+/// Tablebases::direct_probe() looks up pos in its WDL or DTZ table, without the
+/// search of probe_wdl() and probe_dtz(). Sets *result to FAIL if the table is
+/// missing and to CHANGE_STM if the DTZ table only stores the other side to move.
+
+int Tablebases::direct_probe(const Position& pos, bool dtz, ProbeState* result) {
+
+    *result = OK;
+
+    if (dtz)
+    {
+        DTZEntry* entry = EntryTable[pos.subvariant()].get<DTZEntry>(pos.material_key());
+        if (!entry || !init(*entry, pos))
+            return *result = FAIL, 0;
+
+        return do_probe_table(pos, entry, WDLWin, result);
+    }
+
+    WDLEntry* entry = EntryTable[pos.subvariant()].get<WDLEntry>(pos.material_key());
+    if (!entry || !init(*entry, pos))
+        return *result = FAIL, 0;
+
+    return do_probe_table(pos, entry, WDLDraw, result);
+}
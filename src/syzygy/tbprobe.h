@@ -21,6 +21,8 @@
 #define TBPROBE_H
 
 #include <ostream>
+#include <string>
+#include <vector>
 
 #include "../search.h"
 
@@ -46,14 +48,96 @@ enum ProbeState {
 };
 
 extern int MaxCardinality;
+extern int VariantMaxCardinality[SUBVARIANT_NB];
+
+// Tables looked up by the current thread while it is the active TableLog,
+// e.g. during one request. Tables beyond the capacity are only counted.
+struct TableLog {
+    static const int Capacity = 8;
+
+    Key keys[Capacity];
+    char names[Capacity][16]; // Like "KRPvKR"
+    int count = 0;
+    int lookups = 0;
+};
+
+extern thread_local TableLog* ActiveTableLog;
+
+// Plies that probe_wdl() and probe_dtz() play below the probed position at
+// most. Every other ply of their search captures a piece.
+const int MAX_PROBE_PLY = 2 * 32 + 2;
+
+// The states of the positions a thread plays through while probing. Probes
+// use the states from the top on and leave it as it was, callers reserve the
+// states of their own moves with StateFrame. So neither needs StateInfo arrays
+// or a StateInfo in each level of the recursion.
+struct StateStack {
+    StateInfo states[MAX_PLY + MAX_PROBE_PLY];
+    int top; // Zero initialized
+
+    bool contains(const StateInfo* st) const {
+        return st >= states && st < states + MAX_PLY + MAX_PROBE_PLY;
+    }
+
+    static StateStack& local() {
+        static thread_local StateStack stack;
+        return stack;
+    }
+};
+
+// Reserves n states of the thread's StateStack until it goes out of scope.
+// Frames may take up to MAX_PLY states in total: a probe made while they are
+// reserved plays up to MAX_PROBE_PLY more moves on the states above them,
+// which is what the rest of the stack is for.
+class StateFrame {
+    StateStack& stack;
+    int base;
+
+public:
+    explicit StateFrame(int n) : stack(StateStack::local()), base(stack.top) {
+        stack.top += n;
+        assert(stack.top <= MAX_PLY); // Leaves MAX_PROBE_PLY states for probes
+    }
+    StateFrame(const StateFrame&) = delete;
+    StateFrame& operator=(const StateFrame&) = delete;
+    ~StateFrame() { stack.top = base; }
+
+    StateInfo& operator[](int i) { return stack.states[base + i]; }
+};
 
 void init(const std::string& paths, Variant variant);
+void add(const std::string& paths, Variant variant);
+int load_huge(const std::string& code, Variant variant);
+int replicate(const std::string& code, Variant variant);
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves, Value& score);
 bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, Value& score);
 void filter_root_moves(Position& pos, Search::RootMoves& rootMoves);
 
+// A compressed table of the WDL or DTZ file of an entry, one per side to move
+// and file, for the microbenchmarks and checks in tbbench.cpp
+struct PairsTable {
+    std::string label;   // Like "wdl btm file a"
+    void* pairs;         // The PairsData
+    uint64_t size;       // Number of stored values, 0 for single value tables
+    int blockSize;
+    size_t metadataSize; // PairsData with its base64[] and symlen[]
+
+    // The table as stored in the file, so that it can be decoded independently
+    // of PairsData
+    int minSymLen, maxSymLen, spanBits, symlenSize;
+    const uint8_t* lowestSym;   // 16 bit little endian symbols
+    const uint8_t* btree;       // 3 bytes per symbol
+    const uint8_t* sparseIndex; // 32 bit block and 16 bit offset, little endian
+    const uint16_t* blockLength;
+    const uint8_t* data;
+};
+
+bool pairs_tables(const Position& pos, std::vector<PairsTable>& tables);
+int decompress(const PairsTable& table, uint64_t idx);
+int direct_probe(const Position& pos, bool dtz, ProbeState* result);
+
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
     os << (v == WDLLoss        ? "Loss" :
@@ -0,0 +1,175 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The C interface of tbapi.h, a thin layer over the same probing code as the
+// HTTP handlers
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+
+#include "bitboard.h"
+#include "probe.h"
+#include "tbapi.h"
+#include "syzygy/tbprobe.h"
+
+namespace {
+
+// Variants of the build, like the routes of the server
+const Variant Variants[] = {
+#ifdef TABLEBASE_VARIANT
+  TABLEBASE_VARIANT,
+#else
+  CHESS_VARIANT,
+#ifdef ATOMIC
+  ATOMIC_VARIANT,
+#endif
+#ifdef ANTI
+  ANTI_VARIANT,
+#endif
+#endif
+};
+
+std::atomic<bool> opened(false);
+
+bool to_variant(int variant, Variant &v) {
+  switch (variant) {
+      case TB_CHESS: v = CHESS_VARIANT; break;
+#ifdef ANTI
+      case TB_ANTICHESS: v = ANTI_VARIANT; break;
+#endif
+#ifdef ATOMIC
+      case TB_ATOMIC: v = ATOMIC_VARIANT; break;
+#endif
+      default: return false;
+  }
+
+  return std::find(std::begin(Variants), std::end(Variants), v) != std::end(Variants);
+}
+
+bool to_mode(int mode, ProbeMode &m) {
+  switch (mode) {
+      case TB_MODE_WDL: m = MODE_WDL; return true;
+      case TB_MODE_DTZ: m = MODE_DTZ; return true;
+      default: return false;
+  }
+}
+
+// Checks the arguments shared by both probes and sets up the position
+int setup(int variant, const char *fen, int mode, Position &pos, StateInfo *st, ProbeMode &m) {
+  if (!opened.load(std::memory_order_acquire)) return TB_ERROR_CLOSED;
+
+  Variant v;
+  if (!fen || !to_variant(variant, v) || !to_mode(mode, m)) return TB_ERROR_ARGUMENT;
+
+  if (pos.parse_fen(fen, true, v, st, nullptr) != FEN_OK) return TB_ERROR_FEN;
+
+  return TB_OK;
+}
+
+void to_result(const MoveInfo &info, struct tb_result *result) {
+  result->flags = (info.checkmate ? TB_CHECKMATE : 0)
+                | (info.stalemate ? TB_STALEMATE : 0)
+                | (info.variant_win ? TB_VARIANT_WIN : 0)
+                | (info.variant_loss ? TB_VARIANT_LOSS : 0)
+                | (info.insufficient_material ? TB_INSUFFICIENT_MATERIAL : 0)
+                | (info.zeroing ? TB_ZEROING : 0)
+                | (info.has_wdl ? TB_HAS_WDL : 0)
+                | (info.has_dtz ? TB_HAS_DTZ : 0)
+                | (info.failed ? TB_PROBE_FAILED : 0);
+  result->wdl = info.has_wdl ? info.wdl : 0;
+  result->dtz = info.has_dtz ? info.dtz : 0;
+}
+
+} // namespace
+
+extern "C" {
+
+int tb_open(const char *syzygy_path) {
+  if (!syzygy_path) return TB_ERROR_ARGUMENT;
+
+  static bool initialized = false;
+  if (!initialized) {
+      Bitboards::init();
+      Position::init();
+      initialized = true;
+  }
+
+  Tablebases::init(syzygy_path, Variants[0]);
+  for (size_t i = 1; i < sizeof(Variants) / sizeof(Variants[0]); i++) {
+      Tablebases::add(syzygy_path, Variants[i]);
+  }
+
+  opened.store(true, std::memory_order_release);
+  return Tablebases::MaxCardinality;
+}
+
+int tb_probe_fen(int variant, const char *fen, int mode, struct tb_result *result) {
+  if (!result) return TB_ERROR_ARGUMENT;
+
+  Position pos;
+  Tablebases::StateFrame st(1);
+  ProbeMode m;
+  int status = setup(variant, fen, mode, pos, &st[0], m);
+  if (status != TB_OK) return status;
+
+  MoveInfo info = {};
+  probe_position(pos, MoveList<LEGAL>(pos).size(), m, info);
+  to_result(info, result);
+  return TB_OK;
+}
+
+int tb_probe_moves(int variant, const char *fen, int mode, struct tb_move *moves, size_t capacity) {
+  if (!moves) return TB_ERROR_ARGUMENT;
+
+  Position pos;
+  Tablebases::StateFrame states(2);
+  ProbeMode m;
+  int status = setup(variant, fen, mode, pos, &states[0], m);
+  if (status != TB_OK) return status;
+
+  const auto legals = MoveList<LEGAL>(pos);
+  if (legals.size() > capacity) return TB_ERROR_BUFFER;
+
+  MoveInfo infos[MAX_MOVES];
+  size_t num_moves = probe_moves(pos, legals, true, m, states[1], infos);
+
+  for (size_t i = 0; i < num_moves; i++) {
+      static_assert(sizeof(moves[i].uci) >= sizeof(infos[i].uci), "uci does not fit");
+      memcpy(moves[i].uci, infos[i].uci, sizeof(infos[i].uci));
+      memcpy(moves[i].san, infos[i].san, sizeof(moves[i].san));
+      to_result(infos[i], &moves[i].result);
+  }
+
+  return int(num_moves);
+}
+
+void tb_close(void) {
+  opened.store(false, std::memory_order_release);
+  Tablebases::init("<empty>", Variants[0]);
+}
+
+} // extern "C"
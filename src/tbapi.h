@@ -0,0 +1,122 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TBAPI_H_INCLUDED
+#define TBAPI_H_INCLUDED
+
+/* C interface for probing the tablebases in process, without HTTP.
+
+   tb_open() loads the tables of all variants of the build. Afterwards any
+   number of threads may call tb_probe_fen() and tb_probe_moves() at the same
+   time, until tb_close(). Results are written to buffers provided by the
+   caller; apart from loading a table on its first use, probing allocates no
+   memory.
+
+   Values have the same meaning as in the JSON of the HTTP API: wdl is -2
+   (loss), -1 (blessed loss), 0 (draw), 1 (cursed win) or 2 (win) and, like
+   dtz, is from the point of view of the side to move of the probed position.
+   For the moves of tb_probe_moves() that is the opponent.
+
+   The library writes nothing to stdout. Probes that fail although the
+   position is covered by the tables are reported with TB_PROBE_FAILED. */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define TB_API __declspec(dllexport)
+#else
+#define TB_API __attribute__((visibility("default")))
+#endif
+
+/* Variants, fixed regardless of the variants built into the library */
+enum tb_variant {
+  TB_CHESS = 0,
+  TB_ANTICHESS = 1,
+  TB_ATOMIC = 2
+};
+
+/* What to probe. TB_MODE_WDL ignores the halfmove clock. */
+enum tb_mode {
+  TB_MODE_WDL = 0,
+  TB_MODE_DTZ = 1
+};
+
+/* Return values. Errors are negative. */
+enum tb_status {
+  TB_OK = 0,
+  TB_ERROR_ARGUMENT = -1,  /* Null pointer, unknown mode or variant not built in */
+  TB_ERROR_FEN = -2,       /* Invalid FEN or illegal position */
+  TB_ERROR_BUFFER = -3,    /* Fewer output slots than legal moves */
+  TB_ERROR_CLOSED = -4     /* tb_open() has not been called */
+};
+
+/* Flags of struct tb_result */
+#define TB_CHECKMATE             0x01
+#define TB_STALEMATE             0x02
+#define TB_VARIANT_WIN           0x04
+#define TB_VARIANT_LOSS          0x08
+#define TB_INSUFFICIENT_MATERIAL 0x10
+#define TB_ZEROING               0x20  /* Halfmove clock is 0 */
+#define TB_HAS_WDL               0x40
+#define TB_HAS_DTZ               0x80
+#define TB_PROBE_FAILED          0x100 /* Covered by the tables, but a table is missing or could not be read */
+
+struct tb_result {
+  unsigned flags;
+  int wdl;  /* Valid with TB_HAS_WDL */
+  int dtz;  /* Valid with TB_HAS_DTZ */
+};
+
+struct tb_move {
+  char uci[8];
+  char san[8];  /* With check and checkmate suffix */
+  struct tb_result result;
+};
+
+/* Loads the tables found in the given directories, separated by ':' (';' on
+   Windows). Not thread-safe, call it before probing. Returns the largest
+   number of pieces covered by the tables, 0 if none were found. */
+TB_API int tb_open(const char *syzygy_path);
+
+/* Probes the position itself. */
+TB_API int tb_probe_fen(int variant, const char *fen, int mode, struct tb_result *result);
+
+/* Probes the position after each legal move and writes the moves to moves,
+   best first, as in GET /. Returns the number of moves (0 at the end of the
+   game) or an error. MAX_MOVES (256) slots are always enough. */
+TB_API int tb_probe_moves(int variant, const char *fen, int mode, struct tb_move *moves, size_t capacity);
+
+/* Unloads all tables. Not thread-safe, no probes may be running. */
+TB_API void tb_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef TBAPI_H_INCLUDED */
@@ -0,0 +1,786 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Microbenchmarks of the tablebase code. They link the objects of the server
+// and reach the probing internals through the benchmark hooks of tbprobe.h.
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <getopt.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <event2/buffer.h>
+
+#include "arena.h"
+#include "bitboard.h"
+#include "generator.h"
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "probe.h"
+#include "request.h"
+#include "syzygy/tbprobe.h"
+
+using namespace Tablebases;
+
+namespace {
+
+// Default material signatures, when none are given with --material
+const char *chess_materials[] = {
+  "KPvK", "KQvK", "KRvK", "KBNvK", "KRvKB", "KQvKR",
+  "KRPvKR", "KPPvKP", "KRBvKR", "KQPvKQ",
+};
+
+#ifdef ANTI
+const char *anti_materials[] = {
+  "RvK", "QvB", "NvP", "BBvN", "RNvK", "PPvP",
+};
+#endif
+
+// Results are collected as JSON objects and printed at the end
+std::vector<std::string> results;
+
+double min_time = 0.2;  // --time, seconds per measurement
+
+volatile uint64_t sink;
+
+// Calls f() until at least min_time has passed. Each call does ops_per_call
+// operations. Records the time per operation under the given name.
+template<typename F>
+void measure(const std::string &harness, Variant v, const std::string &material, const std::string &detail, size_t ops_per_call, F f) {
+  if (!ops_per_call) return;
+
+  size_t calls = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed;
+  do {
+      f();
+      calls++;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < min_time);
+
+  size_t ops = calls * ops_per_call;
+
+  std::ostringstream ss;
+  ss << "{\"harness\": \"" << harness << "\", "
+     << "\"variant\": \"" << variants[v] << "\", "
+     << "\"material\": \"" << material << "\", ";
+  if (!detail.empty()) ss << detail << ", ";
+  ss << "\"ops\": " << ops << ", "
+     << "\"ns_per_op\": " << elapsed * 1e9 / ops << "}";
+  results.push_back(ss.str());
+}
+
+void bench_decompress_pairs(Variant v, const std::string &material, const Position &pos, PRNG &rng) {
+  std::vector<PairsTable> tables;
+  pairs_tables(pos, tables);
+
+  for (const PairsTable &t : tables) {
+      // Single value tables have no blocks to decompress
+      if (!t.size) continue;
+
+      std::vector<uint64_t> idx(4096);
+      for (auto &i : idx) i = rng.rand<uint64_t>() % t.size;
+
+      std::ostringstream detail;
+      detail << "\"table\": \"" << t.label << "\", \"block_size\": " << t.blockSize
+             << ", \"metadata_bytes\": " << t.metadataSize;
+
+      measure("decompress_pairs", v, material, detail.str(), idx.size(), [&]() {
+          uint64_t sum = 0;
+          for (uint64_t i : idx) sum += decompress(t, i);
+          sink = sum;
+      });
+  }
+}
+
+void bench_material(Variant v, const std::string &material, size_t num_positions, bool with_tables) {
+  PRNG rng(std::hash<std::string>()(variants[v] + material) | 1);
+  EndgameGenerator generator(v, rng.rand<uint64_t>());
+
+  std::vector<std::unique_ptr<Position>> positions;
+  std::deque<StateInfo> states;
+  if (generator.add(material)) {
+      for (size_t i = 0, attempts = 0; i < num_positions && attempts < 1000 * num_positions; attempts++) {
+          std::unique_ptr<Position> pos(new Position);
+          states.emplace_back();
+          generator.next(*pos, &states.back());
+
+          // Positions that never reach the tables
+          if (pos->is_variant_end() || !MoveList<LEGAL>(*pos).size()) {
+              states.pop_back();
+              continue;
+          }
+
+          positions.push_back(std::move(pos));
+          i++;
+      }
+  }
+
+  if (positions.empty()) {
+      std::cerr << "no legal " << variants[v] << " position for " << material << std::endl;
+      return;
+  }
+
+  StateInfo st;
+
+  measure("movegen_legal", v, material, "", positions.size(), [&]() {
+      size_t sum = 0;
+      for (auto &pos : positions) sum += MoveList<LEGAL>(*pos).size();
+      sink = sum;
+  });
+
+  measure("san", v, material, "", positions.size(), [&]() {
+      Bitboard origins[PIECE_TYPE_NB][SQUARE_NB];
+      char san[8];
+      size_t sum = 0;
+      for (auto &pos : positions) {
+          const auto legals = MoveList<LEGAL>(*pos);
+          san_origins(*pos, legals, origins);
+          for (const auto& m : legals) sum += move_san(*pos, m, origins, san) - san;
+      }
+      sink = sum;
+  });
+
+  // Serialization only, with the move infos computed up front
+  std::vector<std::vector<MoveInfo>> infos(positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+      probe_moves(*positions[i], MoveList<LEGAL>(*positions[i]), true, MODE_DTZ, st, infos[i]);
+  }
+
+  struct evbuffer *res = evbuffer_new();
+  measure("json", v, material, "", positions.size(), [&]() {
+      for (const auto &move_infos : infos) {
+          write_move_infos(res, move_infos.data(), move_infos.size(), true);
+          evbuffer_drain(res, evbuffer_get_length(res));
+      }
+  });
+  // The whole body of GET /, including the probes, for each ?mode=
+  static const std::pair<ProbeMode, const char *> modes[] = {
+      {MODE_WDL, "wdl"}, {MODE_DTZ, "dtz"}, {MODE_BEST, "best"}, {MODE_FULL, "full"}
+  };
+  for (auto &mode : modes) {
+      measure("write_moves", v, material, std::string("\"mode\": \"") + mode.second + "\"", positions.size(), [&]() {
+          Request r(v);
+          r.mode = mode.first;
+          for (auto &pos : positions) {
+              write_moves(*pos, r, st, res);
+              Arena::local().reset();
+              evbuffer_drain(res, evbuffer_get_length(res));
+          }
+      });
+  }
+
+  evbuffer_free(res);
+
+  if (!with_tables) return;
+
+  ProbeState state;
+  direct_probe(*positions[0], false, &state);
+  if (state == FAIL) {
+      std::cerr << "no " << variants[v] << " tables for " << material << std::endl;
+      return;
+  }
+
+  bench_decompress_pairs(v, material, *positions[0], rng);
+
+  measure("do_probe_table_wdl", v, material, "", positions.size(), [&]() {
+      int sum = 0;
+      ProbeState result;
+      for (auto &pos : positions) sum += direct_probe(*pos, false, &result);
+      sink = sum;
+  });
+
+  measure("probe_wdl", v, material, "", positions.size(), [&]() {
+      int sum = 0;
+      ProbeState result;
+      for (auto &pos : positions) sum += Tablebases::probe_wdl(*pos, &result);
+      sink = sum;
+  });
+
+  // DTZ tables store only one side to move. Probes for the other side
+  // recurse one ply (CHANGE_STM), so they are measured separately.
+  std::vector<Position*> direct, change_stm;
+  for (auto &pos : positions) {
+      direct_probe(*pos, true, &state);
+      if (state == FAIL) return;
+      (state == CHANGE_STM ? change_stm : direct).push_back(pos.get());
+  }
+
+  measure("probe_dtz", v, material, "\"stm\": \"direct\"", direct.size(), [&]() {
+      int sum = 0;
+      ProbeState result;
+      for (Position *pos : direct) sum += Tablebases::probe_dtz(*pos, &result);
+      sink = sum;
+  });
+
+  measure("probe_dtz", v, material, "\"stm\": \"change\"", change_stm.size(), [&]() {
+      int sum = 0;
+      ProbeState result;
+      for (Position *pos : change_stm) sum += Tablebases::probe_dtz(*pos, &result);
+      sink = sum;
+  });
+}
+
+// Differential checks, run with --check instead of the measurements. Each
+// compares an optimized path with the code it replaced on random input and
+// returns the number of differences, the first few of which are printed.
+
+const int MAX_REPORTED = 10;
+
+void report(const std::string &check, Variant v, const std::string &material, size_t cases, size_t mismatches, const std::string &detail = "") {
+  std::ostringstream ss;
+  ss << "{\"harness\": \"" << check << "\", "
+     << "\"variant\": \"" << variants[v] << "\", ";
+  if (!material.empty()) ss << "\"material\": \"" << material << "\", ";
+  if (!detail.empty()) ss << detail << ", ";
+  ss << "\"cases\": " << cases << ", "
+     << "\"mismatches\": " << mismatches << "}";
+  results.push_back(ss.str());
+}
+
+// The request FEN validation before Position::parse_fen(), as reference. Two
+// of its bugs are fixed, since parse_fen() was meant to fix them: non-digits
+// in the halfmove clock were accepted and a missing fullmove number read past
+// the end. More than 16 pieces per side, which set() cannot store, are
+// rejected as well.
+bool old_validate_fen(const char *fen, Variant v) {
+  // 1. Board setup
+  int wk = 0, bk = 0, pieces[COLOR_NB] = { 0, 0 };
+  for (int rank = 7; rank >= 0; rank--) {
+      bool last_was_number = false;
+      int file = 0;
+
+      for (; file <= 7; file++) {
+          char c = *fen++;
+
+          if (c >= '1' && c <= '8') {
+              if (last_was_number) return false;
+              file += c - '1';
+              last_was_number = true;
+              continue;
+          } else {
+              last_was_number = false;
+          }
+
+          switch (c) {
+              case 'k':
+                  bk++;
+                  break;
+              case 'K':
+                  wk++;
+                  break;
+              case 'p': case 'P':
+                  if (rank == 7 || rank == 0) return false;
+              case 'n': case 'N':
+              case 'b': case 'B':
+              case 'r': case 'R':
+              case 'q': case 'Q':
+                  break;
+
+              default:
+                  return false;
+          }
+          if (++pieces[islower(c) ? BLACK : WHITE] > 16) return false;
+      }
+
+      if (file != 8) return false;
+
+      char c = *fen++;
+      if (!c) return false;
+
+      if (rank > 0) {
+          if (c != '/') return false;
+      } else {
+          if (c != ' ') return false;
+      }
+  }
+
+  bool kings_ok = wk == 1 && bk == 1;
+#ifdef ATOMIC
+  if (v == ATOMIC_VARIANT) kings_ok = wk + bk >= 1 && wk <= 1 && bk <= 1;
+#endif
+#ifdef ANTI
+  if (v == ANTI_VARIANT) kings_ok = true;
+#endif
+  (void)v;
+  if (!kings_ok) return false;
+
+  // 2. Turn.
+  char c = *fen++;
+  if (c != 'w' && c != 'b') return false;
+  if (*fen++ != ' ') return false;
+
+  // 3. Castling
+  c = *fen++;
+  if (c != '-') {
+      do {
+          if (c >= 'a' && c <= 'h') continue;
+          else if (c >= 'A' && c <= 'H') continue;
+          else if (c == 'q' || c == 'Q') continue;
+          else if (c == 'k' || c == 'K') continue;
+          else return false;
+      } while ((c = *fen++) != ' ');
+  } else if (*fen++ != ' ') return false;
+
+  // 4. En-passant
+  c = *fen++;
+  if (c != '-') {
+      if (c < 'a' || c > 'h') return false;
+
+      c = *fen++;
+      if (c != '3' && c != '6') return false;
+  }
+  if (*fen++ != ' ') return false;
+
+  // 5. Halfmove clock.
+  c = *fen++;
+  do {
+      if (c < '0' || c > '9') return false;
+  } while ((c = *fen++) != ' ');
+
+  // 6. Fullmove number.
+  c = *fen++;
+  do {
+      if (c < '0' || c > '9') return false;
+  } while ((c = *fen++) && c != ' ');
+
+  // End
+  if (c) return false;
+  return true;
+}
+
+// Position::parse_fen() against old_validate_fen(), Position::set() and
+// pos_is_ok() on mutations of random and hand picked FENs. Both must agree on
+// acceptance, and accepted positions on their FEN and keys.
+size_t check_parse_fen(Variant v, size_t num_cases) {
+  const char *seeds[] = {
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      "r3k2r/8/8/8/3pP3/8/8/R3K2R b KQkq e3 0 1",
+      "1r2k1r1/8/8/8/8/8/8/1R2K1R1 w BGbg - 12 40",
+  };
+  const char alphabet[] = "KQRBNPkqrbnp012345678/ _-wbaeghAH";
+
+  PRNG rng(std::hash<std::string>()(variants[v] + "parse_fen") | 1);
+  EndgameGenerator generator(v, rng.rand<uint64_t>());
+#ifdef ANTI
+  if (v == ANTI_VARIANT) generator.add_list("RvK,QvB,NvP,BBvN,PPvP");
+  else
+#endif
+  generator.add_list("KPvK,KQvKR,KRPvKR,KPPvKP");
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < num_cases; i++) {
+      std::string fen;
+      if (i % 4 == 0) fen = seeds[rng.rand<unsigned>() % (sizeof(seeds) / sizeof(seeds[0]))];
+      else {
+          StateInfo st;
+          Position pos;
+          generator.next(pos, &st);
+          fen = pos.fen();
+      }
+
+      // Replace, insert or erase a few characters
+      for (int m = rng.rand<unsigned>() % 4; m > 0 && !fen.empty(); m--) {
+          size_t at = rng.rand<unsigned>() % fen.size();
+          char c = alphabet[rng.rand<unsigned>() % (sizeof(alphabet) - 1)];
+          switch (rng.rand<unsigned>() % 3) {
+              case 0: fen[at] = c; break;
+              case 1: fen.insert(at, 1, c); break;
+              default: fen.erase(at, 1);
+          }
+      }
+
+      StateInfo st_new, st_old;
+      Position pos_new, pos_old;
+      bool ok_new = pos_new.parse_fen(fen.c_str(), true, v, &st_new, nullptr) == FEN_OK;
+
+      std::string spaced(fen);
+      std::replace(spaced.begin(), spaced.end(), '_', ' ');
+      bool ok_old = old_validate_fen(spaced.c_str(), v)
+                 && pos_old.set(spaced, true, v, &st_old, nullptr).pos_is_ok();
+
+      if (   ok_new != ok_old
+          || (ok_new && (   pos_new.fen() != pos_old.fen()
+                         || pos_new.key() != pos_old.key()
+                         || pos_new.material_key() != pos_old.material_key()))) {
+          if (mismatches++ < MAX_REPORTED) {
+              std::cerr << "parse_fen differs for " << variants[v] << " " << fen
+                        << " (new " << ok_new << ", old " << ok_old << ")" << std::endl;
+          }
+      }
+  }
+
+  report("check_parse_fen", v, "", num_cases, mismatches);
+  return mismatches;
+}
+
+// decompress_pairs() as it was before the PairsData of an entry were packed
+// into one allocation, as reference: span and block size by division and
+// multiplication, base64[] and symlen[] in vectors of their own, all built
+// from the file data alone.
+class ReferencePairs {
+public:
+  explicit ReferencePairs(const PairsTable &table)
+    : t(table), sizeof_block(t.blockSize), span(size_t(1) << t.spanBits),
+      base64(t.maxSymLen - t.minSymLen + 1), symlen(t.symlenSize), visited(t.symlenSize) {
+
+      for (int i = int(base64.size()) - 2; i >= 0; --i) {
+          base64[i] = (base64[i + 1] + le16(t.lowestSym + 2 * i) - le16(t.lowestSym + 2 * (i + 1))) / 2;
+      }
+      for (size_t i = 0; i < base64.size(); ++i) base64[i] <<= 64 - i - t.minSymLen;
+
+      for (int sym = 0; sym < t.symlenSize; ++sym) {
+          if (!visited[sym]) symlen[sym] = set_symlen(sym);
+      }
+  }
+
+  int decompress(uint64_t idx) const {
+      uint32_t k = uint32_t(idx / span);
+      uint32_t block = le32(t.sparseIndex + 6 * k);
+      int offset = le16(t.sparseIndex + 6 * k + 4);
+      int diff = idx % span - span / 2;
+      offset += diff;
+
+      while (offset < 0) offset += t.blockLength[--block] + 1;
+      while (offset > t.blockLength[block]) offset -= t.blockLength[block++] + 1;
+
+      const uint8_t *ptr = t.data + block * sizeof_block;
+      uint64_t buf64 = uint64_t(be32(ptr)) << 32 | be32(ptr + 4);
+      ptr += 8;
+      int buf64_size = 64;
+      int sym;
+
+      while (true) {
+          int len = 0;
+          while (buf64 < base64[len]) ++len;
+
+          sym = int((buf64 - base64[len]) >> (64 - len - t.minSymLen)) + le16(t.lowestSym + 2 * len);
+          if (offset < symlen[sym] + 1) break;
+
+          offset -= symlen[sym] + 1;
+          len += t.minSymLen;
+          buf64 <<= len;
+          buf64_size -= len;
+          if (buf64_size <= 32) {
+              buf64_size += 32;
+              buf64 |= uint64_t(be32(ptr)) << (64 - buf64_size);
+              ptr += 4;
+          }
+      }
+
+      while (symlen[sym]) {
+          int l = left(sym);
+          if (offset < symlen[l] + 1) sym = l;
+          else {
+              offset -= symlen[l] + 1;
+              sym = right(sym);
+          }
+      }
+
+      return t.btree[3 * sym];
+  }
+
+private:
+  static int le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+  static uint32_t le32(const uint8_t *p) { return uint32_t(le16(p)) | uint32_t(le16(p + 2)) << 16; }
+  static uint32_t be32(const uint8_t *p) { return uint32_t(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+  int left(int sym) const { return (t.btree[3 * sym + 1] & 0xF) << 8 | t.btree[3 * sym]; }
+  int right(int sym) const { return t.btree[3 * sym + 2] << 4 | t.btree[3 * sym + 1] >> 4; }
+
+  uint8_t set_symlen(int sym) {
+      visited[sym] = true;
+      int r = right(sym);
+      if (r == 0xFFF) return 0;
+
+      int l = left(sym);
+      if (!visited[l]) symlen[l] = set_symlen(l);
+      if (!visited[r]) symlen[r] = set_symlen(r);
+      return symlen[l] + symlen[r] + 1;
+  }
+
+  const PairsTable &t;
+  size_t sizeof_block, span;
+  std::vector<uint64_t> base64;
+  std::vector<uint8_t> symlen;
+  std::vector<bool> visited;
+};
+
+// decompress_pairs() against ReferencePairs on random indices of every table
+// of the material, and on the first and last value of every block.
+size_t check_decompress_pairs(Variant v, const std::string &material, size_t num_cases) {
+  StateInfo st;
+  Position pos;
+  pos.set(material, WHITE, v, &st);
+
+  std::vector<PairsTable> tables;
+  if (!pairs_tables(pos, tables)) {
+      std::cerr << "no " << variants[v] << " tables for " << material << std::endl;
+      return 0;
+  }
+
+  PRNG rng(std::hash<std::string>()(variants[v] + material + "decompress_pairs") | 1);
+  size_t cases = 0, mismatches = 0;
+
+  for (const PairsTable &t : tables) {
+      if (!t.size) continue;
+
+      ReferencePairs reference(t);
+      std::vector<uint64_t> idx;
+      for (uint64_t block = 0, first = 0; first < t.size; first += t.blockLength[block++] + 1) {
+          idx.push_back(first);
+          idx.push_back(first + t.blockLength[block]);
+      }
+      for (size_t i = 0; i < num_cases; i++) idx.push_back(rng.rand<uint64_t>() % t.size);
+
+      for (uint64_t i : idx) {
+          int expected = reference.decompress(i), actual = decompress(t, i);
+          if (actual != expected && mismatches++ < MAX_REPORTED) {
+              std::cerr << "decompress_pairs differs for " << variants[v] << " " << material << " " << t.label
+                        << " at " << i << " (" << actual << " instead of " << expected << ")" << std::endl;
+          }
+      }
+      cases += idx.size();
+  }
+
+  report("check_decompress_pairs", v, material, cases, mismatches);
+  return mismatches;
+}
+
+// Probes at the bottom of the thread's StateStack and above a StateFrame of
+// MAX_PLY states, the most callers may reserve, must agree and leave the
+// position as it was. The states above the frame are filled with a pattern
+// first, to find how deep the probes went. Antichess probes recurse through
+// forced captures, also without tables.
+size_t check_state_stack(Variant v, const std::string &material, size_t num_positions) {
+  PRNG rng(std::hash<std::string>()(variants[v] + material + "state_stack") | 1);
+  EndgameGenerator generator(v, rng.rand<uint64_t>());
+  if (!generator.add(material)) return 0;
+
+  StateStack &stack = StateStack::local();
+  size_t cases = 0, mismatches = 0;
+  int max_depth = 0;
+
+  for (size_t i = 0; i < num_positions; i++) {
+      StateInfo st;
+      Position pos;
+      generator.next(pos, &st);
+      if (pos.is_variant_end() || !MoveList<LEGAL>(pos).size()) continue;
+
+      const Key key = pos.key();
+      const std::string fen = pos.fen();
+
+      ProbeState wdl_result, dtz_result, deep_wdl_result, deep_dtz_result;
+      int wdl = probe_wdl(pos, &wdl_result);
+      int dtz = probe_dtz(pos, &dtz_result);
+
+      int deep_wdl, deep_dtz, depth = MAX_PROBE_PLY;
+      {
+          StateFrame frame(MAX_PLY);
+          unsigned char *free_states = reinterpret_cast<unsigned char *>(stack.states + stack.top);
+          memset(free_states, 0xA5, MAX_PROBE_PLY * sizeof(StateInfo));
+
+          deep_wdl = probe_wdl(pos, &deep_wdl_result);
+          deep_dtz = probe_dtz(pos, &deep_dtz_result);
+
+          while (depth > 0 && std::all_of(free_states + (depth - 1) * sizeof(StateInfo),
+                                          free_states + depth * sizeof(StateInfo),
+                                          [](unsigned char c) { return c == 0xA5; })) depth--;
+      }
+      max_depth = std::max(max_depth, depth);
+      cases++;
+
+      if (   wdl_result != deep_wdl_result || dtz_result != deep_dtz_result
+          || (wdl_result != FAIL && wdl != deep_wdl)
+          || (dtz_result != FAIL && dtz != deep_dtz)
+          || pos.key() != key || pos.fen() != fen || stack.top != 0) {
+          if (mismatches++ < MAX_REPORTED) {
+              std::cerr << "probes differ above a StateFrame for " << variants[v] << " " << fen << std::endl;
+          }
+      }
+  }
+
+  std::ostringstream detail;
+  detail << "\"max_depth\": " << max_depth << ", \"max_probe_ply\": " << MAX_PROBE_PLY;
+  report("check_state_stack", v, material, cases, mismatches, detail.str());
+  return mismatches;
+}
+
+size_t run_checks(Variant v, const std::vector<std::string> &materials, size_t num_positions, bool with_tables) {
+  size_t mismatches = check_parse_fen(v, 200 * num_positions);
+
+  for (const std::string &material : materials) {
+      if (with_tables) mismatches += check_decompress_pairs(v, material, 100 * num_positions);
+      mismatches += check_state_stack(v, material, num_positions);
+  }
+
+#ifdef ANTI
+  // Many pieces and captures, for deep recursion
+  if (v == ANTI_VARIANT) {
+      for (const char *material : { "QRBNvQRBN", "RRBBNNvRRBBNN", "PPPPPPvPPPPPP", "QQQQQQQQvRRRRRRRR" }) {
+          mismatches += check_state_stack(v, material, num_positions);
+      }
+  }
+#endif
+
+  return mismatches;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  char *syzygy_path = NULL;
+  std::vector<std::string> materials;
+  size_t num_positions = 1000;
+  static int check = 0;
+
+  static struct option long_options[] = {
+      {"check",     no_argument,       &check, 1},
+      {"syzygy",    required_argument, 0, 's'},
+      {"material",  required_argument, 0, 'm'},
+      {"positions", required_argument, 0, 'n'},
+      {"time",      required_argument, 0, 't'},
+      {NULL, 0, 0, 0},
+  };
+
+  while (true) {
+      int option_index;
+      int opt = getopt_long(argc, argv, "s:m:n:t:", long_options, &option_index);
+      if (opt < 0) {
+          break;
+      }
+
+      switch (opt) {
+          case 0:
+              break;
+
+          case 's':
+              if (!syzygy_path) {
+                  syzygy_path = strdup(optarg);
+              } else {
+                  syzygy_path = (char *) realloc(syzygy_path, strlen(syzygy_path) + 1 + strlen(optarg) + 1);
+                  strcat(syzygy_path, ":");
+                  strcat(syzygy_path, optarg);
+              }
+              break;
+
+          case 'm': {
+              std::stringstream ss(optarg);
+              std::string material;
+              while (std::getline(ss, material, ',')) {
+                  if (!material.empty()) materials.push_back(material);
+              }
+              break;
+          }
+
+          case 'n':
+              num_positions = atoi(optarg);
+              if (!num_positions) {
+                  std::cerr << "invalid number of positions: " << optarg << std::endl;
+                  return 78;
+              }
+              break;
+
+          case 't':
+              min_time = atof(optarg);
+              if (min_time <= 0) {
+                  std::cerr << "invalid time: " << optarg << std::endl;
+                  return 78;
+              }
+              break;
+
+          case '?':
+              return 78;
+
+          default:
+              std::cerr << "getopt error: " << opt << std::endl;
+              abort();
+      }
+  }
+
+  if (optind != argc) {
+      std::cerr << "unexpected positional argument" << std::endl;
+      return 78;
+  }
+
+  // Keep stdout for the JSON report
+  std::streambuf *out = std::cout.rdbuf(std::cerr.rdbuf());
+
+  Bitboards::init();
+  Position::init();
+
+  bool with_tables = syzygy_path != NULL;
+  if (!syzygy_path) syzygy_path = strdup("<empty>");
+  Tablebases::init(syzygy_path, routes[0].variant);
+  for (const Route &route : routes) {
+      if (route.variant != routes[0].variant) Tablebases::add(syzygy_path, route.variant);
+  }
+
+  std::cout.rdbuf(out);
+
+  size_t mismatches = 0;
+  for (const Route &route : routes) {
+      std::vector<std::string> codes = materials;
+      if (codes.empty()) {
+#ifdef ANTI
+          if (route.variant == ANTI_VARIANT) codes.assign(std::begin(anti_materials), std::end(anti_materials));
+          else
+#endif
+          codes.assign(std::begin(chess_materials), std::end(chess_materials));
+      }
+
+      if (check) {
+          mismatches += run_checks(route.variant, codes, num_positions, with_tables);
+          continue;
+      }
+
+      for (const std::string &material : codes) {
+          bench_material(route.variant, material, num_positions, with_tables);
+      }
+  }
+
+  std::cout << "{\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+      std::cout << "    " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  std::cout << "  ],\n";
+
+  // Peak resident memory, including the tables touched
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << "  \"max_rss_kb\": " << usage.ru_maxrss << "\n}" << std::endl;
+
+  return mismatches ? 1 : 0;
+}
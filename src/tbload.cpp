@@ -0,0 +1,522 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Load generator for tbserve. Replays FEN lists or access logs over many
+// keep-alive connections at a fixed request rate and reports the latency
+// distribution.
+//
+// The rate is open-loop: request i is due at start + i / rate, whether or not
+// earlier requests have been answered. Latencies are measured from that
+// intended start, so that a stalled server shows up in the tail instead of
+// quietly lowering the request rate (coordinated omission).
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/buffer.h>
+
+namespace {
+
+// Log-linear histogram of microseconds in the style of HdrHistogram: each
+// power of two is split into SUB_BUCKETS / 2 buckets, so that recorded values
+// are exact up to SUB_BUCKETS and within 1% above.
+class Histogram {
+public:
+  static const int SUB_BITS = 7;
+  static const int64_t SUB_BUCKETS = 1 << SUB_BITS;
+
+  Histogram() : counts(SUB_BUCKETS + 48 * SUB_BUCKETS / 2), total(0), sum(0), sum_squares(0), max(0) {}
+
+  void record(int64_t value) {
+      if (value < 0) value = 0;
+      counts[index(value)]++;
+      total++;
+      sum += double(value);
+      sum_squares += double(value) * double(value);
+      if (value > max) max = value;
+  }
+
+  uint64_t count() const { return total; }
+  int64_t maximum() const { return max; }
+  double mean() const { return total ? sum / total : 0; }
+  double stddev() const { return total ? sqrt(std::max(0.0, sum_squares / total - mean() * mean())) : 0; }
+
+  // Highest value equivalent to the one at the given quantile
+  int64_t percentile(double q) const {
+      uint64_t rank = std::max<uint64_t>(1, uint64_t(ceil(q * total)));
+      uint64_t seen = 0;
+      for (size_t i = 0; i < counts.size(); i++) {
+          seen += counts[i];
+          if (seen >= rank) return std::min(highest_equivalent(i), max);
+      }
+      return max;
+  }
+
+private:
+  static size_t index(int64_t value) {
+      if (value < SUB_BUCKETS) return size_t(value);
+      int shift = 64 - __builtin_clzll(uint64_t(value)) - SUB_BITS;
+      return size_t(SUB_BUCKETS + (shift - 1) * SUB_BUCKETS / 2 + ((value >> shift) - SUB_BUCKETS / 2));
+  }
+
+  static int64_t highest_equivalent(size_t i) {
+      if (int64_t(i) < SUB_BUCKETS) return int64_t(i);
+      int64_t shift = (int64_t(i) - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+      int64_t sub = (int64_t(i) - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+      return ((sub + 1) << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts;
+  uint64_t total;
+  double sum, sum_squares;
+  int64_t max;
+};
+
+struct Connection {
+  struct evhttp_connection *evcon;
+  int64_t intended;  // When the current request was due
+  int64_t sent;      // When it was actually sent
+};
+
+struct Due {
+  size_t target;
+  int64_t intended;
+};
+
+// Options
+const char *host = "127.0.0.1";
+int port = 5000;
+double rate = 1000;  // Requests per second, 0 for as fast as possible
+int num_connections = 32;
+double duration = 0;  // Seconds, 0 to replay the input once
+int timeout = 10;  // Seconds
+
+std::vector<std::string> targets;  // Request URIs, in input order
+
+struct event_base *base;
+std::vector<Connection> connections;
+std::vector<Connection *> idle;
+std::deque<Due> backlog;  // Due requests waiting for an idle connection
+size_t issued = 0;  // Requests that have become due
+size_t in_flight = 0;
+bool stopping = false;
+
+int64_t start_time;
+int64_t end_time;  // Last moment a request may become due
+
+Histogram response_time;  // From intended start, including client queueing
+Histogram service_time;   // From the moment the request was written
+uint64_t status_classes[6];  // 1xx to 5xx, [0] for transport errors
+uint64_t response_bytes = 0;
+
+int64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Reads the string member key of a JSON object on a single line, as written
+// by the access log of tbserve. Returns false if there is no such member.
+bool json_string(const std::string &line, const char *key, std::string &value) {
+  size_t pos = line.find("\"" + std::string(key) + "\":");
+  if (pos == std::string::npos) return false;
+  pos = line.find_first_not_of(" ", pos + strlen(key) + 3);
+  if (pos == std::string::npos || line[pos] != '"') return false;
+
+  value.clear();
+  for (pos++; pos < line.size() && line[pos] != '"'; pos++) {
+      if (line[pos] == '\\' && pos + 1 < line.size()) pos++;
+      value += line[pos];
+  }
+  return pos < line.size();
+}
+
+// Appends "?fen=" and the encoded FEN to target
+void append_fen(std::string &target, const std::string &fen) {
+  char *encoded = evhttp_encode_uri(fen.c_str());
+  if (!encoded) {
+      std::cout << "could not encode uri" << std::endl;
+      abort();
+  }
+  target += "?fen=";
+  target += encoded;
+  free(encoded);
+}
+
+// Extracts the request URI from a line of input. Accepts lines of the JSON
+// access log of tbserve, of common or combined access logs
+// ("GET /?fen=... HTTP/1.1"), bare request URIs and FENs, which are requested
+// from path.
+bool parse_target(const std::string &line, const char *path, std::string &target) {
+  size_t begin = line.find_first_not_of(" \t\r");
+  if (begin == std::string::npos || line[begin] == '#') return false;
+  size_t end = line.find_last_not_of(" \t\r") + 1;
+
+  if (line[begin] == '{') {
+      std::string fen, query;
+      if (!json_string(line, "path", target)) return false;  // E.g. {"dropped": n}
+      if (json_string(line, "fen", fen) && !fen.empty()) append_fen(target, fen);
+      if (json_string(line, "query", query) && !query.empty()) {
+          target += target.find('?') == std::string::npos ? "?" : "&";
+          target += query;
+      }
+      return true;
+  }
+
+  size_t get = line.find("\"GET ");
+  if (get != std::string::npos) {
+      begin = get + 5;
+      end = line.find(' ', begin);
+      if (end == std::string::npos) return false;
+      target = line.substr(begin, end - begin);
+      return true;
+  }
+
+  if (line[begin] == '/') {
+      end = line.find_first_of(" \t\r", begin);
+      target = line.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+      return true;
+  }
+
+  target = path;
+  append_fen(target, line.substr(begin, end - begin));
+  return true;
+}
+
+void send_request(Connection *conn, const Due &due);
+
+void finish_if_done() {
+  if (stopping && backlog.empty() && !in_flight) event_base_loopbreak(base);
+}
+
+void on_response(struct evhttp_request *req, void *arg) {
+  Connection *conn = (Connection *) arg;
+  int64_t now = now_us();
+  in_flight--;
+
+  int code = req ? evhttp_request_get_response_code(req) : 0;
+  if (code >= 100 && code < 600) {
+      status_classes[code / 100]++;
+      response_bytes += evbuffer_get_length(evhttp_request_get_input_buffer(req));
+      response_time.record(now - conn->intended);
+      service_time.record(now - conn->sent);
+  } else {
+      status_classes[0]++;
+  }
+
+  // Closed loop: the connection immediately asks for the next target
+  if (!rate && !stopping) {
+      if (duration ? now < end_time : issued < targets.size()) {
+          Due due = { issued++ % targets.size(), now };
+          send_request(conn, due);
+          return;
+      }
+      stopping = true;
+  }
+
+  if (!backlog.empty()) {
+      Due due = backlog.front();
+      backlog.pop_front();
+      send_request(conn, due);
+  } else {
+      idle.push_back(conn);
+      finish_if_done();
+  }
+}
+
+void send_request(Connection *conn, const Due &due) {
+  struct evhttp_request *req = evhttp_request_new(on_response, conn);
+  if (!req) {
+      std::cout << "could not allocate request" << std::endl;
+      abort();
+  }
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Host", host);
+
+  conn->intended = due.intended;
+  conn->sent = now_us();
+  in_flight++;
+  if (evhttp_make_request(conn->evcon, req, EVHTTP_REQ_GET, targets[due.target].c_str()) != 0) {
+      // The request has been freed, count it as a transport error
+      in_flight--;
+      status_classes[0]++;
+      idle.push_back(conn);
+  }
+}
+
+// Makes the requests that became due since the last tick
+void on_tick(evutil_socket_t, short, void *) {
+  int64_t now = now_us();
+
+  while (!stopping) {
+      int64_t intended = start_time + int64_t(issued * 1e6 / rate);
+      if (intended > now) break;
+
+      if (duration ? intended >= end_time : issued >= targets.size()) {
+          stopping = true;
+          break;
+      }
+
+      Due due = { issued++ % targets.size(), intended };
+      backlog.push_back(due);
+  }
+
+  while (!backlog.empty() && !idle.empty()) {
+      Connection *conn = idle.back();
+      idle.pop_back();
+      Due due = backlog.front();
+      backlog.pop_front();
+      send_request(conn, due);
+  }
+
+  finish_if_done();
+}
+
+void print_report(double elapsed) {
+  static const double quantiles[] = { 0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1.0 };
+
+  std::cout << "\n       Value   Percentile   TotalCount 1/(1-Percentile)\n\n";
+  for (double q : quantiles) {
+      char line[80];
+      if (q < 1.0) {
+          snprintf(line, sizeof(line), "%12.3f %12.6f %12llu %14.2f\n",
+                   response_time.percentile(q) / 1000.0, q,
+                   (unsigned long long) uint64_t(ceil(q * response_time.count())), 1 / (1 - q));
+      } else {
+          snprintf(line, sizeof(line), "%12.3f %12.6f %12llu\n",
+                   response_time.maximum() / 1000.0, q,
+                   (unsigned long long) response_time.count());
+      }
+      std::cout << line;
+  }
+
+  char summary[160];
+  snprintf(summary, sizeof(summary),
+           "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n"
+           "#[Max     = %12.3f, Total count    = %12llu]\n",
+           response_time.mean() / 1000.0, response_time.stddev() / 1000.0,
+           response_time.maximum() / 1000.0, (unsigned long long) response_time.count());
+  std::cout << summary;
+
+  std::cout << "\n==========================="
+            << "\nTarget rate (1/s)     : " << (rate ? std::to_string(int64_t(rate)) : "unlimited")
+            << "\nAchieved rate (1/s)   : " << int64_t(response_time.count() / elapsed)
+            << "\nConnections           : " << num_connections
+            << "\nTotal time (ms)       : " << int64_t(elapsed * 1000)
+            << "\nResponses             : " << response_time.count()
+            << "\nResponse bytes        : " << response_bytes
+            << "\nStatus 2xx/3xx/4xx/5xx: " << status_classes[2] << "/" << status_classes[3]
+                                            << "/" << status_classes[4] << "/" << status_classes[5]
+            << "\nTransport errors      : " << status_classes[0]
+            << "\nResponse p50 (ms)     : " << response_time.percentile(0.5) / 1000.0
+            << "\nResponse p99 (ms)     : " << response_time.percentile(0.99) / 1000.0
+            << "\nResponse p999 (ms)    : " << response_time.percentile(0.999) / 1000.0
+            << "\nService p50 (ms)      : " << service_time.percentile(0.5) / 1000.0
+            << "\nService p99 (ms)      : " << service_time.percentile(0.99) / 1000.0
+            << "\nService p999 (ms)     : " << service_time.percentile(0.999) / 1000.0 << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  setlinebuf(stdout);
+
+  const char *path = "/";
+
+  // Parse command line options
+  static struct option long_options[] = {
+      {"host",        required_argument, 0, 'h'},
+      {"port",        required_argument, 0, 'p'},
+      {"rate",        required_argument, 0, 'r'},
+      {"connections", required_argument, 0, 'c'},
+      {"duration",    required_argument, 0, 'd'},
+      {"timeout",     required_argument, 0, 't'},
+      {"path",        required_argument, 0, 'P'},
+      {NULL, 0, 0, 0},
+  };
+
+  while (true) {
+      int option_index;
+      int opt = getopt_long(argc, argv, "h:p:r:c:d:t:", long_options, &option_index);
+      if (opt < 0) {
+          break;
+      }
+
+      switch (opt) {
+          case 'h':
+              host = optarg;
+              break;
+
+          case 'p':
+              port = atoi(optarg);
+              if (!port) {
+                  printf("invalid port: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'r':
+              rate = atof(optarg);
+              if (rate < 0) {
+                  printf("invalid rate: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'c':
+              num_connections = atoi(optarg);
+              if (num_connections < 1) {
+                  printf("invalid number of connections: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'd':
+              duration = atof(optarg);
+              if (duration < 0) {
+                  printf("invalid duration: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 't':
+              timeout = atoi(optarg);
+              if (timeout < 1) {
+                  printf("invalid timeout: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'P':
+              path = optarg;
+              break;
+
+          case '?':
+              return 78;
+
+          default:
+              std::cout << "getopt error: " << opt << std::endl;
+              abort();
+      }
+  }
+
+  if (optind == argc) {
+      std::cout << "usage: " << argv[0] << " [--host 127.0.0.1] [--port 5000] [--rate 1000] "
+                << "[--connections 32] [--duration 0] [--timeout 10] [--path /] file..." << std::endl;
+      return 78;
+  }
+
+  // Read the targets. "-" is stdin.
+  for (int i = optind; i < argc; i++) {
+      std::ifstream file;
+      if (strcmp(argv[i], "-")) {
+          file.open(argv[i]);
+          if (!file.is_open()) {
+              std::cout << "could not open " << argv[i] << std::endl;
+              return 78;
+          }
+      }
+      std::istream &in = strcmp(argv[i], "-") ? file : std::cin;
+
+      std::string line, target;
+      while (std::getline(in, line)) {
+          if (parse_target(line, path, target)) targets.push_back(target);
+      }
+  }
+
+  if (targets.empty()) {
+      std::cout << "no requests to replay" << std::endl;
+      return 78;
+  }
+
+  base = event_base_new();
+  if (!base) {
+      std::cout << "could not initialize event_base" << std::endl;
+      abort();
+  }
+
+  connections.resize(num_connections);
+  for (Connection &conn : connections) {
+      conn.evcon = evhttp_connection_base_new(base, NULL, host, port);
+      if (!conn.evcon) {
+          std::cout << "could not create connection to " << host << ":" << port << std::endl;
+          abort();
+      }
+      evhttp_connection_set_timeout(conn.evcon, timeout);
+      idle.push_back(&conn);
+  }
+
+  std::cout << "replaying " << targets.size() << " requests to " << host << ":" << port << std::endl;
+
+  start_time = now_us();
+  end_time = start_time + int64_t(duration * 1e6);
+
+  struct event *tick = NULL;
+  if (rate) {
+      tick = event_new(base, -1, EV_PERSIST, on_tick, NULL);
+      struct timeval interval = { 0, 1000 };
+      if (!tick || event_add(tick, &interval) != 0) {
+          std::cout << "could not add timer" << std::endl;
+          abort();
+      }
+      on_tick(-1, 0, NULL);
+  } else {
+      // Closed loop: every connection keeps exactly one request in flight
+      std::vector<Connection *> ready;
+      ready.swap(idle);
+      for (Connection *conn : ready) {
+          if (!duration && issued >= targets.size()) {
+              idle.push_back(conn);
+              continue;
+          }
+          Due due = { issued++ % targets.size(), now_us() };
+          send_request(conn, due);
+      }
+      if (!in_flight) {
+          stopping = true;
+          finish_if_done();
+      }
+  }
+
+  event_base_dispatch(base);
+
+  double elapsed = (now_us() - start_time) / 1e6;
+
+  if (tick) event_free(tick);
+  for (Connection &conn : connections) evhttp_connection_free(conn.evcon);
+  event_base_free(base);
+
+  if (!response_time.count()) {
+      std::cout << "no responses" << std::endl;
+      return 69;
+  }
+
+  print_report(elapsed);
+  return 0;
+}
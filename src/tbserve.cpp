@@ -24,568 +24,595 @@
 */
 
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <algorithm>
-
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <thread>
+
+#include <errno.h>
 #include <string.h>
 #include <getopt.h>
+#include <signal.h>
 
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/buffer.h>
 #include <event2/keyvalq_struct.h>
+#include <event2/thread.h>
 
 #ifdef GAVIOTA
 #include <gtb-probe.h>
 #endif
 
+#include "accesslog.h"
+#include "admission.h"
+#include "arena.h"
 #include "bitboard.h"
+#include "generator.h"
+#include "misc.h"
 #include "position.h"
+#include "probe.h"
+#include "request.h"
 #include "search.h"
-#include "thread.h"
-#include "tt.h"
+#include "shmserver.h"
+#include "tbapi.h"
+#include "trace.h"
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 
-namespace PSQT {
-  void init();
-}
-
 namespace {
 
-static int verbose = 0;  // --verbose
 static int cors = 0;  // --cors
 
-std::string move_san(Position &pos, const Move &move, const MoveList<LEGAL> &legals) {
-  Square from = from_sq(move);
-  Square to = to_sq(move);
+static int trace_sample = 0;  // --trace-sample, trace one in that many requests
+static int trace_inline = 0;  // --trace-inline, to honor trace=1
+static uint64_t trace_counter = 0;  // Only used by the event loop
+
+// Sampled traces, served by /trace
+const size_t TRACE_RING_EVENTS = 1 << 16;
+Trace::Recorder trace_ring(TRACE_RING_EVENTS);
+
+// Upper bound for the trace of one request, about 140 KB of events. Older
+// events of longer requests are dropped.
+const size_t TRACE_INLINE_EVENTS = 1 << 10;
+
+AccessLog access_log;  // --access-log
+
+static int num_workers = 0;  // --workers, 0 to handle requests in the event loop
+static int queue_size = 256;  // --queue
+static int batch_pieces = 0;  // --batch-pieces, 0 to only go by priority=batch
+static int numa = 0;  // --numa, to bind workers to nodes round-robin
+
+ShmServer shm_server;  // --shm
+
+// Reasons of the 400 Bad Request replies, by FenError
+const char *fen_errors[] = {
+  "OK",
+  "Invalid FEN: board",
+  "Invalid FEN: kings",
+  "Invalid FEN: turn",
+  "Invalid FEN: castling",
+  "Invalid FEN: en passant",
+  "Invalid FEN: halfmove clock",
+  "Invalid FEN: fullmove number",
+  "Illegal FEN",
+};
 
-  if (type_of(move) == CASTLING) {
-      if (to > from) return "O-O";
-      else return "O-O-O";
+// Replies with an error instead of a body
+void fail(Request &r, int status, const char *reason) {
+  r.status = status;
+  r.reason = reason;
+}
+
+// Starts tracing the request if it was asked for with trace=1 and the server
+// runs with --trace-inline, or if it is picked by --trace-sample. Sampled
+// traces are added to the ring served by /trace when the reply is sent.
+void begin_trace(Request &r) {
+  const char *c_trace = r.param("trace");
+  bool inline_trace = trace_inline && c_trace && !strcmp(c_trace, "1");
+  if (!inline_trace && !r.trace_sampled) return;
+
+  r.trace_sampled = !inline_trace;
+  r.trace.reset(new Trace::Recorder(TRACE_INLINE_EVENTS));
+  Trace::active() = r.trace.get();
+  r.trace_scope.reset(new Trace::Scope("request", r.fen));
+}
+
+// Hands the request over to the access log, before the reply is sent
+void log_request(const Request &r, int status, size_t bytes) {
+  if (!access_log.is_open()) return;
+
+  AccessLog::Entry e;
+  e.time = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  e.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - r.start).count();
+
+  size_t path_len = std::min(strcspn(r.uri, "?"), sizeof(e.path) - 1);
+  memcpy(e.path, r.uri, path_len);
+  e.path[path_len] = '\0';
+
+  strncpy(e.fen, r.fen ? r.fen : "", sizeof(e.fen) - 1);
+  e.fen[sizeof(e.fen) - 1] = '\0';
+
+  // The other parameters change the cost of the request, like mode and
+  // bestmove. Only whole parameters that fit are kept.
+  e.query_size = 0;
+  for (const char *p = r.query; p < r.query + r.query_size; ) {
+      const char *value = p + strlen(p) + 1;
+      const char *next = value + strlen(value) + 1;
+      if (evutil_ascii_strcasecmp(p, "fen") && size_t(next - p) <= sizeof(e.query) - e.query_size) {
+          memcpy(e.query + e.query_size, p, next - p);
+          e.query_size += uint32_t(next - p);
+      }
+      p = next;
   }
 
-  std::string san;
+  e.status = status;
+  e.bytes = uint32_t(bytes);
+  e.positions = uint32_t(r.num_probes);
+  e.tables = r.tables;
+  access_log.log(e);
+}
+
+// Parses the query parameters and sets up the position. Replies with an
+// error and returns false if the request is invalid.
+bool parse_request(Request &r, Position &pos, StateInfo *st) {
+  r.start_probes = probes;
+  if (access_log.is_open()) Tablebases::ActiveTableLog = &r.tables;
+  if (r.status != HTTP_OK) return false;  // See Request()
+
+  r.fen = r.param("fen");
+  r.jsonp = r.param("callback");
+  const char *notation = r.param("notation");
+  const char *c_mode = r.param("mode");
+  if (!r.fen || !strlen(r.fen)) {
+      fail(r, HTTP_BADREQUEST, "Missing FEN");
+      return false;
+  }
+  begin_trace(r);
+  if (r.jsonp && !strlen(r.jsonp)) r.jsonp = nullptr;
 
-  PieceType pt = type_of(pos.piece_on(from));
+  r.with_san = !notation || strcmp(notation, "uci");
 
-  if (pt == PAWN) {
-      if (file_of(from) != file_of(to)) {
-          san += char('a' + file_of(from));
-          san += 'x';
-      }
-      san += UCI::square(to);
-      if (type_of(move) == PROMOTION) {
-          san += '=';
-          san += " PNBRQK"[promotion_type(move)];
+  if (c_mode && !strcmp(c_mode, "wdl")) r.mode = MODE_WDL;
+  else if (c_mode && !strcmp(c_mode, "dtz")) r.mode = MODE_DTZ;
+  else if (c_mode && !strcmp(c_mode, "best")) r.mode = MODE_BEST;
+  else if (c_mode && strcmp(c_mode, "full")) {
+      fail(r, HTTP_BADREQUEST, "Invalid mode");
+      return false;
+  }
+
+  Trace::Scope trace("parse_fen");
+  FenError error = pos.parse_fen(r.fen, true, r.variant, st, nullptr);
+  trace.stop();
+  if (error != FEN_OK) {
+      if (verbose) {
+          std::cout << "rejected: " << r.fen << " (" << fen_errors[error] << ")" << std::endl;
       }
-      return san;
+      fail(r, HTTP_BADREQUEST, fen_errors[error]);
+      return false;
+  }
+
+  if (verbose) {
+      std::cout << "probing: " << r.fen << std::endl;
   }
 
-  san = " PNBRQK"[pt];
+  return true;
+}
 
-  bool rank = false, file = false;
-  for (const Move &candidate : legals) {
-      if (candidate == move) continue;
-      if (to_sq(candidate) != to) continue;
-      if (type_of(pos.piece_on(from_sq(candidate))) != pt) continue;
+struct evbuffer *begin_response(Request &r) {
+  r.body = evbuffer_new();
+  if (!r.body) {
+      std::cout << "could not allocate response buffer" << std::endl;
+      abort();
+  }
 
-      if (rank_of(from_sq(candidate)) == rank_of(from)) file = true;
-      if (file_of(from_sq(candidate)) == file_of(from)) rank = true;
-      else file = true;
+  if (r.jsonp) {
+      evbuffer_add_printf(r.body, "%s(", r.jsonp);
   }
-  if (file) san += char('a' + file_of(from));
-  if (rank) san += char('1' + rank_of(from));
 
-  if (pos.piece_on(to)) san += 'x';
-  san += UCI::square(to);
-  return san;
+  return r.body;
 }
 
-template<Variant>
-bool validate_kings(int wk, int bk) {
-  return wk == 1 && bk == 1;
+void end_response(Request &r, struct evbuffer *res) {
+  // Insert an inline trace as the first member of the JSON object
+  if (r.trace && !r.trace_sampled) {
+      r.trace_scope->stop();
+      std::string head = r.jsonp ? std::string(r.jsonp) + "(" : std::string();
+      evbuffer_drain(res, head.size() + 1);  // Up to and including the "{"
+      head += "{\n  \"trace\": ";
+      r.trace->write_json(head);
+      head += ",";
+      evbuffer_prepend(res, head.data(), head.size());
+  }
+
+  if (r.jsonp) evbuffer_add_printf(res, ")\n");
+  else evbuffer_add_printf(res, "\n");
 }
 
-#ifdef ATOMIC
-template<>
-bool validate_kings<ATOMIC_VARIANT>(int wk, int bk) {
-  return wk + bk >= 1 && wk <= 1 && bk <= 1;
+// Sends the reply from the event loop
+void send_reply(struct evhttp_request *req, Request &r) {
+  struct evkeyvalq *headers = evhttp_request_get_output_headers(req);
+  if (cors) {
+      evhttp_add_header(headers, "Access-Control-Allow-Origin", "*");
+  }
+
+  if (r.status == HTTP_OK) {
+      evhttp_add_header(headers, "Content-Type", r.jsonp ? "application/javascript" : "application/json");
+      log_request(r, r.status, evbuffer_get_length(r.body));
+      evhttp_send_reply(req, HTTP_OK, "OK", r.body);
+  } else {
+      log_request(r, r.status, 0);
+      evhttp_send_error(req, r.status, r.reason);
+  }
+
+  if (r.trace && r.trace_sampled) trace_ring.append(*r.trace);
 }
-#endif
 
-#ifdef ANTI
-template<>
-bool validate_kings<ANTI_VARIANT>(int wk, int bk) {
-  return true;
+void get_api(Request &r) {
+  Tablebases::StateFrame states(2);
+  Position pos;
+  if (!parse_request(r, pos, &states[0])) return;
+
+  struct evbuffer *res = begin_response(r);
+  write_moves(pos, r, states[1], res);
+  end_response(r, res);
 }
-#endif
 
-bool validate_fen(const char *fen) {
-  // 1. Board setup
-  int wk = 0, bk = 0;
-  for (int rank = 7; rank >= 0; rank--) {
-      bool last_was_number = false;
-      int file = 0;
-
-      for (; file <= 7; file++) {
-          char c = *fen++;
-
-          if (c >= '1' && c <= '8') {
-              if (last_was_number) return false;
-              file += c - '1';
-              last_was_number = true;
-              continue;
-          } else {
-              last_was_number = false;
-          }
+// Picks a move that preserves the tablebase result of the root position and
+// makes progress according to DTZ (or only WDL in wdl mode). Returns MOVE_NONE
+// if the position is not in the tablebases.
+Move probe_best_move(Position &pos, const MoveList<LEGAL> &legals, ProbeMode mode) {
+  if (!legals.size()) return MOVE_NONE;
+  if (pos.can_castle(ANY_CASTLING) || popcount(pos.pieces()) > Tablebases::VariantMaxCardinality[pos.subvariant()]) return MOVE_NONE;
+
+  Search::RootMoves root_moves;
+  for (const auto& m : legals) root_moves.push_back(Search::RootMove(m));
+
+  // Filters root_moves down to the moves that preserve the result.
+  Value score;
+  if (mode == MODE_WDL) {
+      if (!Tablebases::root_probe_wdl(pos, root_moves, score)) return MOVE_NONE;
+      return root_moves[0].pv[0];
+  }
+  if (!Tablebases::root_probe(pos, root_moves, score)) return MOVE_NONE;
 
-          switch (c) {
-              case 'k':
-                  bk++;
-                  break;
-              case 'K':
-                  wk++;
-                  break;
-              case 'p': case 'P':
-                  if (rank == 7 || rank == 0) return false;
-              case 'n': case 'N':
-              case 'b': case 'B':
-              case 'r': case 'R':
-              case 'q': case 'Q':
-                  break;
-
-              default:
-                  return false;
-          }
-      }
+  // The remaining scores all have the same sign, so the lowest is the
+  // fastest win or the slowest loss.
+  const Search::RootMove *best = &root_moves[0];
+  for (const auto& rm : root_moves) {
+      if (rm.score < best->score) best = &rm;
+  }
+  return best->pv[0];
+}
+
+void probe_api(Request &r) {
+  Tablebases::StateFrame states(2);
+  Position pos;
+  if (!parse_request(r, pos, &states[0])) return;
+
+  const char *c_bestmove = r.param("bestmove");
+  bool with_best_move = c_bestmove && !strcmp(c_bestmove, "true");
 
-      if (file != 8) return false;
+  struct evbuffer *res = begin_response(r);
+
+  const auto legals = MoveList<LEGAL>(pos);
 
-      char c = *fen++;
-      if (!c) return false;
+  MoveInfo info = {};
+  probe_position(pos, legals.size(), r.mode, info);
 
-      if (rank > 0) {
-          if (c != '/') return false;
+  evbuffer_add_printf(res, "{\n");
+  evbuffer_add_printf(res, "  \"checkmate\": %s,\n", info.checkmate ? "true" : "false");
+  evbuffer_add_printf(res, "  \"stalemate\": %s,\n", info.stalemate ? "true": "false");
+  evbuffer_add_printf(res, "  \"variant_win\": %s,\n", info.variant_win ? "true": "false");
+  evbuffer_add_printf(res, "  \"variant_loss\": %s,\n", info.variant_loss ? "true": "false");
+  evbuffer_add_printf(res, "  \"insufficient_material\": %s,\n", info.insufficient_material ? "true": "false");
+
+  if (info.has_wdl) evbuffer_add_printf(res, "  \"wdl\": %d,\n", info.wdl);
+  else evbuffer_add_printf(res, "  \"wdl\": null,\n");
+
+  if (info.has_dtz) evbuffer_add_printf(res, "  \"dtz\": %d", info.dtz);
+  else evbuffer_add_printf(res, "  \"dtz\": null");
+
+  if (info.has_dtm) evbuffer_add_printf(res, ",\n  \"dtm\": %d", info.dtm);
+
+  if (with_best_move) {
+      Move m = probe_best_move(pos, legals, r.mode);
+      if (m == MOVE_NONE) {
+          evbuffer_add_printf(res, ",\n  \"bestmove\": null");
       } else {
-          if (c != ' ') return false;
+          char uci[8];
+          move_uci(m, uci);
+          evbuffer_add_printf(res, ",\n  \"bestmove\": {\"uci\": \"%s\"", uci);
+          if (r.with_san) {
+              Bitboard origins[PIECE_TYPE_NB][SQUARE_NB];
+              char san[8];
+              san_origins(pos, legals, origins);
+              char *san_end = move_san(pos, m, origins, san);
+              pos.do_move(m, states[1]);
+              size_t num_moves = MoveList<LEGAL>(pos).size();
+              bool mate = (num_moves == 0 && pos.checkers()) || variant_win(pos, num_moves) || variant_loss(pos);
+              if (mate) *san_end++ = '#';
+              else if (pos.checkers()) *san_end++ = '+';
+              *san_end = '\0';
+              pos.undo_move(m);
+              evbuffer_add_printf(res, ", \"san\": \"%s\"", san);
+          }
+          evbuffer_add_printf(res, "}");
       }
   }
-  if (!validate_kings<TABLEBASE_VARIANT>(wk, bk)) return false;
-
-  // 2. Turn.
-  char c = *fen++;
-  if (c != 'w' && c != 'b') return false;
-  if (*fen++ != ' ') return false;
-
-  // 3. Castling
-  c = *fen++;
-  if (c != '-') {
-      do {
-          if (c >= 'a' && c <= 'h') continue;
-          else if (c >= 'A' && c <= 'H') continue;
-          else if (c == 'q' || c == 'Q') continue;
-          else if (c == 'k' || c == 'K') continue;
-          else return false;
-      } while ((c = *fen++) != ' ');
-  } else if (*fen++ != ' ') return false;
-
-  // 4. En-passant
-  c = *fen++;
-  if (c != '-') {
-      if (c < 'a' || c > 'h') return false;
-
-      c = *fen++;
-      if (c != '3' && c != '6') return false;
-  }
-  if (*fen++ != ' ') return false;
-
-  // 5. Halfmove clock.
-  c = *fen++;
-  do {
-      if (c < '0' && c > '9') return false;
-  } while ((c = *fen++) != ' ');
-
-  // 6. Fullmove number.
-  c = *fen++;
-  do {
-      if (c < '0' || c > '9') return false;
-  } while ((c = *fen++) && c != ' ');
-
-  // End
-  if (c) return false;
-  return true;
-}
 
-template<Variant>
-bool insufficient_material(const Position &pos) {
-  return false;
+  // End response
+  evbuffer_add_printf(res, "\n}");
+  end_response(r, res);
 }
 
-template<>
-bool insufficient_material<CHESS_VARIANT>(const Position &pos) {
-  // Easy mating material
-  if (pos.pieces(PAWN) || pos.pieces(ROOK) || pos.pieces(QUEEN)) return false;
-
-  // A single knight or a single bishop
-  if (popcount(pos.pieces(KNIGHT) | pos.pieces(BISHOP)) == 1) return true;
+// Upper bound on the number of plies returned by /mainline
+const int MAINLINE_MAX = 100;
 
-  // More than a single knight
-  if (pos.pieces(KNIGHT)) return false;
+void mainline_api(Request &r) {
+  Tablebases::StateFrame states(MAINLINE_MAX + 2);
+  StateInfo *st = &states[0];
+  Position pos;
+  if (!parse_request(r, pos, st++)) return;
 
-  // All bishops on the same color
-  if (!(pos.pieces(BISHOP) & DarkSquares)) return true;
-  else if (!(pos.pieces(BISHOP) & ~DarkSquares)) return true;
-  else return false;
-}
+  // The line is chosen by DTZ, so WDL alone is not enough. Only the first
+  // move is used, so DTM is only needed for the moves of the best WDL.
+  ProbeMode mode = r.mode == MODE_WDL ? MODE_DTZ : r.mode == MODE_FULL ? MODE_BEST : r.mode;
 
-#ifdef ATOMIC
-template<>
-bool insufficient_material<ATOMIC_VARIANT>(const Position &pos) {
-  // King already dead.
-  if (pos.is_atomic_win() || pos.is_atomic_loss()) return false;
+  struct evbuffer *res = begin_response(r);
 
-  // Sometimes sufficient mating material
-  if (pos.pieces(PAWN) || pos.pieces(QUEEN)) return false;
+  evbuffer_add_printf(res, "{\n");
+  evbuffer_add_printf(res, "  \"mainline\": [");
 
-  // A single knight, bishop or rook
-  if (popcount(pos.pieces(KNIGHT) | pos.pieces(BISHOP) | pos.pieces(ROOK)) == 1) return true;
+  // Follow the best move until it resets the halfmove clock or ends the
+  // game. Drawn positions have no meaningful line.
+  MoveInfo *move_infos = Arena::local().alloc<MoveInfo>(MAX_MOVES);
+  int ply = 0;
+  bool truncated = false;
+  while (true) {
+      // The previous move kept a decisive result without ending the game or
+      // resetting the clock, so the line goes on
+      if (ply == MAINLINE_MAX) {
+          truncated = true;
+          break;
+      }
 
-  // Only knights
-  if (pos.pieces() == (pos.pieces(KING) | pos.pieces(KNIGHT))) return popcount(pos.pieces(KNIGHT)) <= 2;
+      const auto legals = MoveList<LEGAL>(pos);
+      if (!probe_moves(pos, legals, false, mode, *st, move_infos)) break;
+
+      const MoveInfo &m = move_infos[0];
+      bool game_over = m.checkmate || m.variant_win || m.variant_loss;
+      if (!m.has_wdl || m.wdl == 0 || (!m.has_dtz && !game_over)) break;
+
+      evbuffer_add_printf(res, ply ? ",\n" : "\n");
+      evbuffer_add_printf(res, "    {\"uci\": \"%s\", ", m.uci);
+      if (r.with_san) {
+          // Only for the move that is played, not for all its siblings
+          Bitboard origins[PIECE_TYPE_NB][SQUARE_NB];
+          char san[8];
+          san_origins(pos, legals, origins);
+          char *san_end = move_san(pos, m.move, origins, san);
+          if (game_over) *san_end++ = '#';
+          else if (pos.gives_check(m.move)) *san_end++ = '+';
+          *san_end = '\0';
+          evbuffer_add_printf(res, "\"san\": \"%s\", ", san);
+      }
+      if (m.has_dtz) evbuffer_add_printf(res, "\"wdl\": %d, \"dtz\": %d}", m.wdl, m.dtz);
+      else evbuffer_add_printf(res, "\"wdl\": %d, \"dtz\": null}", m.wdl);
+      ply++;
 
-  // Only bishops
-  if (pos.pieces() == (pos.pieces(KING) | pos.pieces(BISHOP))) {
-      // All bishops on opposite colors
-      if (!(pos.pieces(WHITE, BISHOP) & DarkSquares))
-          return !(pos.pieces(BLACK, BISHOP) & ~DarkSquares);
-      if (!(pos.pieces(WHITE, BISHOP) & ~DarkSquares))
-          return !(pos.pieces(BLACK, BISHOP) & DarkSquares);
+      if (m.zeroing || game_over) break;
+      pos.do_move(m.move, *st++);
   }
 
-  return false;
+  // End response
+  evbuffer_add_printf(res, ply ? "\n  ],\n" : "],\n");
+  evbuffer_add_printf(res, "  \"truncated\": %s\n", truncated ? "true" : "false");
+  evbuffer_add_printf(res, "}");
+  end_response(r, res);
 }
-#endif
 
-struct MoveInfo {
-  std::string uci;
-  std::string san;
+typedef void (*Handler)(Request &r);
 
-  bool insufficient_material;
-  bool checkmate;
-  bool variant_win;
-  bool variant_loss;
-  bool stalemate;
-  bool zeroing;
+// The argument of dispatch(): which handler serves which variant
+struct Endpoint {
+  Handler handler;
+  Variant variant;
+};
 
-  bool has_wdl;
-  int wdl;
+std::deque<Endpoint> endpoints;  // Stable addresses
 
-  bool has_dtz;
-  int dtz;
+// A request on its way through the admission queue and a worker
+struct Job {
+  struct evhttp_request *req;
+  Handler handler;
+  Request r;
 
-  bool has_dtm;
-  int dtm;
+  Job(struct evhttp_request *request, const Endpoint &endpoint)
+    : req(request), handler(endpoint.handler), r(request, endpoint.variant) {
+      r.trace_sampled = trace_sample && ++trace_counter % trace_sample == 0;
+  }
 };
 
-bool compare_move_info(const MoveInfo &a, const MoveInfo &b) {
-  if (a.has_wdl && b.has_wdl && a.wdl != b.wdl) return a.wdl < b.wdl;
-  if (a.checkmate != b.checkmate) return a.checkmate;
-  if (a.variant_loss != b.variant_loss) return a.variant_loss;
-  if (a.variant_win != b.variant_win) return b.variant_win;
-  if (a.stalemate != b.stalemate) return a.stalemate;
-  if (a.insufficient_material != b.insufficient_material) return a.insufficient_material;
+struct event_base *base;  // The event loop, which sends all replies
+AdmissionQueue<Job *> *admission = nullptr;
 
-  if (a.has_dtm && b.has_dtm && b.dtm != a.dtm) return b.dtm < a.dtm;
+// Storage of finished jobs for reuse. Jobs are only created and destroyed by
+// the event loop, so that the pool needs no lock.
+std::vector<void *> free_jobs;
+std::atomic<int> busy_workers(0);
 
-  if (a.has_wdl && b.has_wdl && a.wdl < 0 && b.zeroing != a.zeroing) return a.zeroing;
-  if (a.has_wdl && b.has_wdl && a.wdl > 0 && a.zeroing != b.zeroing) return b.zeroing;
+// Seconds after which shed requests may be retried
+const char *RETRY_AFTER = "1";
 
-  if (a.has_dtz && b.has_dtz && a.dtz != b.dtz) return b.dtz < a.dtz;
+// Runs the handler of a job on the calling thread
+void run(Job &job) {
+  job.handler(job.r);
 
-  if (a.has_dtz != b.has_dtz) return b.has_dtz;
-  if (a.has_wdl != b.has_wdl) return b.has_wdl;
+  // The thread local state of the request ends with the handler
+  if (job.r.trace_scope) job.r.trace_scope->stop();
+  Trace::active() = nullptr;
+  Tablebases::ActiveTableLog = nullptr;
+  Arena::local().reset();
+  job.r.num_probes = probes - job.r.start_probes;
+}
 
-  return a.uci.compare(b.uci) < 0;
+void reply(evutil_socket_t, short, void *arg) {
+  Job *job = static_cast<Job *>(arg);
+  send_reply(job->req, job->r);
+  job->~Job();
+  free_jobs.push_back(job);
 }
 
-#ifdef GAVIOTA
-int probe_dtm(const Position &pos, bool *success) {
-  *success = false;
-  if (insufficient_material<TABLEBASE_VARIANT>(pos)) return 0;
-  if (popcount(pos.pieces()) > 5) return 0;
-  if (pos.can_castle(ANY_CASTLING)) return 0;
-
-  unsigned ws[17];
-  unsigned bs[17];
-  unsigned char wp[17];
-  unsigned char bp[17];
-
-  unsigned i = 0;
-  Bitboard white = pos.pieces(WHITE);
-  while (white) {
-      Square sq = pop_lsb(&white);
-      ws[i] = sq;
-
-      if (pos.piece_on(sq) == W_PAWN) wp[i] = tb_PAWN;
-      else if (pos.piece_on(sq) == W_KNIGHT) wp[i] = tb_KNIGHT;
-      else if (pos.piece_on(sq) == W_BISHOP) wp[i] = tb_BISHOP;
-      else if (pos.piece_on(sq) == W_ROOK) wp[i] = tb_ROOK;
-      else if (pos.piece_on(sq) == W_QUEEN) wp[i] = tb_QUEEN;
-      else if (pos.piece_on(sq) == W_KING) wp[i] = tb_KING;
-      else {
-          std::cout << "inconsistent white bitboard" << std::endl;
-          abort();
-      }
-      i++;
-  }
-  ws[i] = tb_NOSQUARE;
-  wp[i] = tb_NOPIECE;
-
-  i = 0;
-  Bitboard black = pos.pieces(BLACK);
-  while (black) {
-      Square sq = pop_lsb(&black);
-      bs[i] = sq;
-
-      if (pos.piece_on(sq) == B_PAWN) bp[i] = tb_PAWN;
-      else if (pos.piece_on(sq) == B_KNIGHT) bp[i] = tb_KNIGHT;
-      else if (pos.piece_on(sq) == B_BISHOP) bp[i] = tb_BISHOP;
-      else if (pos.piece_on(sq) == B_ROOK) bp[i] = tb_ROOK;
-      else if (pos.piece_on(sq) == B_QUEEN) bp[i] = tb_QUEEN;
-      else if (pos.piece_on(sq) == B_KING) bp[i] = tb_KING;
-      else {
-          std::cout << "inconsistent black bitboard" << std::endl;
-          abort();
-      }
-      i++;
-  }
-  bs[i] = tb_NOSQUARE;
-  bp[i] = tb_NOPIECE;
+void shed(Job *job) {
+  evhttp_add_header(evhttp_request_get_output_headers(job->req), "Retry-After", RETRY_AFTER);
+  fail(job->r, HTTP_SERVUNAVAIL, "Service Unavailable");
+  reply(-1, 0, job);
+}
 
-  unsigned info = 0;
-  unsigned plies_to_mate = 0;
-  unsigned available = tb_probe_hard(pos.side_to_move() == WHITE ? tb_WHITE_TO_MOVE : tb_BLACK_TO_MOVE,
-                                     pos.ep_square() != SQ_NONE ? TB_squares(pos.ep_square()) : tb_NOSQUARE,
-                                     0, ws, bs, wp, bp, &info, &plies_to_mate);
-  if (!available || info == tb_FORBID || info == tb_UNKNOWN) {
-      if (verbose) {
-          std::cout << "gaviota probe failed: info = " << info << std::endl;
+// Requests are interactive, unless asked for with priority=batch or, with
+// --batch-pieces, the position has at least that many pieces.
+Priority priority(const Request &r) {
+  const char *c_priority = r.param("priority");
+  if (c_priority && !strcmp(c_priority, "batch")) return PRIORITY_BATCH;
+
+  const char *fen = r.param("fen");
+  if (batch_pieces && fen) {
+      int pieces = 0;
+      for (const char *c = fen; *c && *c != ' ' && *c != '_'; c++) {  // Board only
+          if (isalpha(*c)) pieces++;
       }
-      return 0;
+      if (pieces >= batch_pieces) return PRIORITY_BATCH;
   }
 
-  if (info == tb_DRAW) return 0;
-
-  *success = true;
-
-  if (info == tb_WMATE && pos.side_to_move() == WHITE) {
-      return plies_to_mate;
-  } else if (info == tb_BMATE && pos.side_to_move() == BLACK) {
-      return plies_to_mate;
-  } else if (info == tb_WMATE && pos.side_to_move() == BLACK) {
-      return -plies_to_mate;
-  } else if (info == tb_BMATE && pos.side_to_move() == WHITE) {
-      return -plies_to_mate;
-  } else {
-      std::cout << "gaviota tablebase error, info = " << info << std::endl;
-      abort();
-  }
+  return PRIORITY_INTERACTIVE;
 }
-#endif
 
-void get_api(struct evhttp_request *req, void *) {
-  const char *uri = evhttp_request_get_uri(req);
-  if (!uri) {
-      std::cout << "evhttp_request_get_uri failed" << std::endl;
-      return;
-  }
-
-  struct evkeyvalq *headers = evhttp_request_get_output_headers(req);
-  if (cors) {
-      evhttp_add_header(headers, "Access-Control-Allow-Origin", "*");
+// Entry point of all position requests. Without workers the request is
+// handled right away, otherwise it is queued or shed.
+void dispatch(struct evhttp_request *req, void *arg) {
+  void *storage;
+  if (free_jobs.empty()) storage = ::operator new(sizeof(Job));
+  else {
+      storage = free_jobs.back();
+      free_jobs.pop_back();
   }
+  Job *job = new (storage) Job(req, *static_cast<Endpoint *>(arg));
 
-  struct evkeyvalq query;
-  const char *jsonp = nullptr;
-  const char *c_fen = nullptr;
-  if (0 == evhttp_parse_query(uri, &query)) {
-      c_fen = evhttp_find_header(&query, "fen");
-      jsonp = evhttp_find_header(&query, "callback");
-  }
-  if (!c_fen || !strlen(c_fen)) {
-      evhttp_send_error(req, HTTP_BADREQUEST, "Missing FEN");
+  if (!num_workers) {
+      run(*job);
+      reply(-1, 0, job);
       return;
   }
 
-  std::string fen(c_fen);
-  std::replace(fen.begin(), fen.end(), '_', ' ');
+  Job *evicted;
+  bool has_evicted;
+  if (!admission->push(job, priority(job->r), evicted, has_evicted)) shed(job);
+  else if (has_evicted) shed(evicted);
+}
 
-  if (!validate_fen(fen.c_str())) {
-      evhttp_send_error(req, HTTP_BADREQUEST, "Invalid FEN");
-      return;
+// Worker threads handle queued requests and hand them back to the event loop
+// to send the reply. With --numa they are bound to a node first.
+void work(int node) {
+  if (node >= 0 && !Numa::bind(node)) {
+      std::cout << "could not bind worker to NUMA node " << node << std::endl;
   }
 
-  if (verbose) {
-      std::cout << "probing: " << fen << std::endl;
-  }
+  while (true) {
+      Job *job = admission->pop();
 
-  StateInfo states[MAX_MOVES];
-  StateInfo *st = states;
-  Position pos;
-  pos.set(fen, true, TABLEBASE_VARIANT, st++, Threads.main());
-  if (!pos.pos_is_ok()) {
-      evhttp_send_error(req, HTTP_BADREQUEST, "Illegal FEN");
-      return;
-  }
+      busy_workers++;
+      run(*job);
+      busy_workers--;
 
-  // Set content type
-  if (jsonp && strlen(jsonp)) {
-      evhttp_add_header(headers, "Content-Type", "application/javascript");
-  } else {
-      evhttp_add_header(headers, "Content-Type", "application/json");
+      struct timeval immediately = {0, 0};
+      if (event_base_once(base, -1, EV_TIMEOUT, reply, job, &immediately) != 0) {
+          std::cout << "event_base_once failed" << std::endl;
+          abort();
+      }
   }
+}
+
+// Admission control metrics in the Prometheus text format
+void metrics_api(struct evhttp_request *req, void *) {
+  AdmissionQueue<Job *>::Stats stats = {};
+  if (admission) stats = admission->stats();
 
-  // Build response
   struct evbuffer *res = evbuffer_new();
   if (!res) {
       std::cout << "could not allocate response buffer" << std::endl;
       abort();
   }
 
-  const auto legals = MoveList<LEGAL>(pos);
+  const char *classes[PRIORITY_NB] = {"interactive", "batch"};
 
-  if (jsonp && strlen(jsonp)) {
-      evbuffer_add_printf(res, "%s(", jsonp);
-  }
-
-  bool checkmate = legals.size() == 0 && pos.checkers();
-  bool variant_win = false;
-  bool variant_loss = false;
-
-#if defined(ATOMIC)
-  variant_win = pos.is_atomic_win();
-  variant_loss = pos.is_atomic_loss();
-#elif defined(ANTI)
-  variant_win = legals.size() == 0 || pos.is_anti_win();
-  variant_loss = pos.is_anti_loss();
-#endif
-
-  bool stalemate = legals.size() == 0 && !checkmate && !variant_win && !variant_loss;
-
-  evbuffer_add_printf(res, "{\n");
-  evbuffer_add_printf(res, "  \"checkmate\": %s,\n", checkmate ? "true" : "false");
-  evbuffer_add_printf(res, "  \"stalemate\": %s,\n", stalemate ? "true": "false");
-  evbuffer_add_printf(res, "  \"variant_win\": %s,\n", variant_win ? "true": "false");
-  evbuffer_add_printf(res, "  \"variant_loss\": %s,\n", variant_loss ? "true": "false");
-  evbuffer_add_printf(res, "  \"moves\": [\n");
-
-  std::vector<MoveInfo> move_infos;
-
-  if (checkmate) goto skip_moves;
-
-  for (const auto& m : legals) {
-      MoveInfo info = {};
-      info.uci = UCI::move(m, true);
-      info.san = move_san(pos, m, legals);
-
-      pos.do_move(m, *st++);
-      int num_moves = MoveList<LEGAL>(pos).size();
-
-      info.checkmate = num_moves == 0 && pos.checkers();
-#if defined(ATOMIC)
-      info.variant_win = pos.is_atomic_win();
-      info.variant_loss = pos.is_atomic_loss();
-#elif defined(ANTI)
-      info.variant_win = num_moves == 0 || pos.is_anti_win();
-      info.variant_loss = pos.is_anti_loss();
-#endif
-      info.stalemate = num_moves == 0 && !info.checkmate && !info.variant_win && !info.variant_loss;
-      info.insufficient_material = insufficient_material<TABLEBASE_VARIANT>(pos);
-      info.zeroing = pos.rule50_count() == 0;
-
-      if (info.checkmate || info.variant_win || info.variant_loss) info.san += '#';
-      else if (pos.checkers()) info.san += '+';
-
-      if (info.checkmate || info.variant_loss) {
-          info.has_wdl = true;
-          info.wdl = -2;
-          info.has_dtm = info.checkmate;
-          info.dtm = 0;
-      } else if (info.variant_win) {
-          info.has_wdl = true;
-          info.wdl = 2;
-      } else if (info.stalemate || info.insufficient_material) {
-          info.has_wdl = true;
-          info.wdl = 0;
-      } else if (!pos.can_castle(ANY_CASTLING) && popcount(pos.pieces()) <= Tablebases::MaxCardinality) {
-          Tablebases::ProbeState state;
-          info.dtz = Tablebases::probe_dtz(pos, &state);
-          info.has_dtz = state != Tablebases::FAIL;
-          if (!info.has_dtz) {
-              std::cout << "dtz probe failed after " << UCI::move(m, true) << std::endl;
-          } else {
-              info.has_wdl = true;
-              if (info.dtz < -100 && info.dtz - pos.rule50_count() <= -100) info.wdl = -1;
-              else if (info.dtz > 100 && info.dtz + pos.rule50_count() >= -100) info.wdl = 1;
-              else if (info.dtz < 0) info.wdl = -2;
-              else if (info.dtz > 0) info.wdl = 2;
-              else info.wdl = 0;
+  evbuffer_add_printf(res, "# HELP tbserve_workers Worker threads.\n# TYPE tbserve_workers gauge\n");
+  evbuffer_add_printf(res, "tbserve_workers %d\n", num_workers);
+  evbuffer_add_printf(res, "# HELP tbserve_workers_busy Worker threads handling a request.\n# TYPE tbserve_workers_busy gauge\n");
+  evbuffer_add_printf(res, "tbserve_workers_busy %d\n", busy_workers.load());
+  evbuffer_add_printf(res, "# HELP tbserve_queue_capacity Requests that may wait for a worker.\n# TYPE tbserve_queue_capacity gauge\n");
+  evbuffer_add_printf(res, "tbserve_queue_capacity %zu\n", stats.capacity);
 
-#ifdef GAVIOTA
-              info.dtm = probe_dtm(pos, &info.has_dtm);
-#endif
-          }
-      } else {
-          info.has_wdl = false;
-      }
-
-      move_infos.push_back(info);
-
-      pos.undo_move(m);
+  evbuffer_add_printf(res, "# HELP tbserve_queue_depth Requests waiting for a worker.\n# TYPE tbserve_queue_depth gauge\n");
+  for (int p = 0; p < PRIORITY_NB; p++) {
+      evbuffer_add_printf(res, "tbserve_queue_depth{priority=\"%s\"} %zu\n", classes[p], stats.depth[p]);
+  }
+  evbuffer_add_printf(res, "# HELP tbserve_requests_admitted_total Requests queued for a worker.\n# TYPE tbserve_requests_admitted_total counter\n");
+  for (int p = 0; p < PRIORITY_NB; p++) {
+      evbuffer_add_printf(res, "tbserve_requests_admitted_total{priority=\"%s\"} %llu\n", classes[p], (unsigned long long) stats.admitted[p]);
+  }
+  evbuffer_add_printf(res, "# HELP tbserve_requests_shed_total Requests answered with 503 because the queue was full.\n# TYPE tbserve_requests_shed_total counter\n");
+  for (int p = 0; p < PRIORITY_NB; p++) {
+      evbuffer_add_printf(res, "tbserve_requests_shed_total{priority=\"%s\"} %llu\n", classes[p], (unsigned long long) stats.shed[p]);
+  }
+  evbuffer_add_printf(res, "# HELP tbserve_requests_evicted_total Batch requests shed after being admitted, to make room for interactive ones.\n# TYPE tbserve_requests_evicted_total counter\n");
+  evbuffer_add_printf(res, "tbserve_requests_evicted_total %llu\n", (unsigned long long) stats.evicted);
+  if (shm_server.is_open()) {
+      evbuffer_add_printf(res, "# HELP tbserve_shm_requests_total Probes answered through shared memory.\n# TYPE tbserve_shm_requests_total counter\n");
+      evbuffer_add_printf(res, "tbserve_shm_requests_total %llu\n", (unsigned long long) shm_server.served());
   }
 
-  sort(move_infos.begin(), move_infos.end(), compare_move_info);
-
-skip_moves:
-
-  for (size_t i = 0; i < move_infos.size(); i++) {
-      const MoveInfo &m = move_infos[i];
-
-      evbuffer_add_printf(res, "    {\"uci\": \"%s\", \"san\": \"%s\", \"checkmate\": %s, \"stalemate\": %s, \"variant_win\": %s, \"variant_loss\": %s, \"insufficient_material\": %s, \"zeroing\": %s, ",
-                          m.uci.c_str(), m.san.c_str(),
-                          m.checkmate ? "true" : "false",
-                          m.stalemate ? "true": "false",
-                          m.variant_win ? "true": "false",
-                          m.variant_loss ? "true": "false",
-                          m.insufficient_material ? "true": "false",
-                          m.zeroing ? "true": "false");
-
-      if (m.has_wdl) evbuffer_add_printf(res, "\"wdl\": %d, ", m.wdl);
-      else evbuffer_add_printf(res, "\"wdl\": null, ");
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "text/plain; version=0.0.4");
+  evhttp_send_reply(req, HTTP_OK, "OK", res);
+  evbuffer_free(res);
+}
 
-      if (m.has_dtz) evbuffer_add_printf(res, "\"dtz\": %d", m.dtz);
-      else evbuffer_add_printf(res, "\"dtz\": null");
+void trace_api(struct evhttp_request *req, void *) {
+  std::string json;
+  trace_ring.write_json(json);
 
-      if (m.has_dtm) evbuffer_add_printf(res, ", \"dtm\": %d}", m.dtm);
-      else evbuffer_add_printf(res, "}");
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "application/json");
 
-      evbuffer_add_printf(res, (i + 1 < move_infos.size()) ? ",\n" : "\n");
+  struct evbuffer *res = evbuffer_new();
+  if (!res) {
+      std::cout << "could not allocate response buffer" << std::endl;
+      abort();
   }
-
-  // End response
-  evbuffer_add_printf(res, "  ]\n");
-  evbuffer_add_printf(res, "}");
-  if (jsonp && strlen(jsonp)) evbuffer_add_printf(res, ")\n");
-  else evbuffer_add_printf(res, "\n");
-
+  evbuffer_add(res, json.data(), json.size());
   evhttp_send_reply(req, HTTP_OK, "OK", res);
-
   evbuffer_free(res);
 }
 
+// SIGHUP reopens the access log, after it has been moved away for rotation
+void reopen_access_log(evutil_socket_t, short, void *) {
+  access_log.reopen();
+}
+
 int serve(int port) {
-  struct event_base *base = event_base_new();
+  // Workers hand replies to the event loop, which needs locking for that
+  if (num_workers && evthread_use_pthreads() != 0) {
+      std::cout << "could not initialize libevent threading" << std::endl;
+      abort();
+  }
+
+  base = event_base_new();
   if (!base) {
       std::cout << "could not initialize event_base" << std::endl;
       abort();
@@ -597,7 +624,38 @@ int serve(int port) {
       abort();
   }
 
-  evhttp_set_gencb(http, get_api, NULL);
+  for (const Route &route : routes) {
+      std::string prefix = route.prefix;
+      if (!prefix.empty()) {
+          endpoints.push_back({get_api, route.variant});
+          evhttp_set_cb(http, prefix.c_str(), dispatch, &endpoints.back());
+      }
+      endpoints.push_back({probe_api, route.variant});
+      evhttp_set_cb(http, (prefix + "/probe").c_str(), dispatch, &endpoints.back());
+      endpoints.push_back({mainline_api, route.variant});
+      evhttp_set_cb(http, (prefix + "/mainline").c_str(), dispatch, &endpoints.back());
+  }
+
+  evhttp_set_cb(http, "/metrics", metrics_api, nullptr);
+  if (trace_sample) evhttp_set_cb(http, "/trace", trace_api, nullptr);
+
+  if (access_log.is_open()) {
+      struct event *hup = evsignal_new(base, SIGHUP, reopen_access_log, nullptr);
+      if (!hup || evsignal_add(hup, nullptr) != 0) {
+          std::cout << "could not add SIGHUP handler" << std::endl;
+          abort();
+      }
+  }
+
+#ifdef TABLEBASE_VARIANT
+  endpoints.push_back({get_api, routes[0].variant});
+  evhttp_set_gencb(http, dispatch, &endpoints.back());
+#endif
+
+  if (num_workers) {
+      admission = new AdmissionQueue<Job *>(queue_size);
+      for (int i = 0; i < num_workers; i++) std::thread(work, numa ? i % Numa::nodes() : -1).detach();
+  }
 
   struct evhttp_bound_socket *socket = evhttp_bind_socket_with_handle(http, "127.0.0.1", port);
   if (!socket) {
@@ -605,11 +663,154 @@ int serve(int port) {
       return 1;
   }
 
-  std::cout << variants[TABLEBASE_VARIANT] << " tbserve listening on http://127.0.0.1:" << port << " ..." << std::endl;
+  for (const Route &route : routes) {
+      std::cout << variants[route.variant] << " ";
+  }
+  std::cout << "tbserve listening on http://127.0.0.1:" << port << " ..." << std::endl;
 
   return event_base_dispatch(base);
 }
 
+
+// Endgames replayed by --bench when no FEN file is given
+const char *bench_fens[] = {
+  "8/6B1/8/8/B7/8/K1pk4/8 b - - 0 1",
+  "8/8/8/4k3/8/8/8/KQ6 w - - 0 1",
+  "8/8/8/4k3/8/8/4P3/4K3 w - - 0 1",
+  "8/8/4k3/8/3PK3/8/8/r6R w - - 0 1",
+  "8/8/8/8/8/2k5/8/KBN5 w - - 0 1",
+  "8/8/8/3k4/8/8/1r6/K3Q3 w - - 0 1",
+  "8/8/8/8/2b5/3k4/8/KR6 b - - 0 1",
+  "8/5k2/8/3p4/2PP4/8/8/3K4 w - - 0 1",
+  "8/8/8/4k3/4p3/8/8/2KNN3 w - - 0 1",
+  "8/8/8/8/3k4/8/6r1/K1RB4 w - - 0 1",
+  "8/8/2k5/8/2PP4/8/1p6/1K1R4 b - - 0 1",
+  "8/8/8/3pP3/8/8/8/4K2k w - d6 0 2",
+  "7k/6Q1/6K1/8/8/8/8/8 b - - 0 1",
+  "4k3/8/8/8/8/8/8/4K2R w K - 0 1",
+  "8/2p5/8/1P6/8/5k2/8/3K3R w - - 37 80",
+  "1n6/8/8/8/8/2k5/8/1K1R4 w - - 0 1",
+};
+
+// Minimum number of positions to replay, so that small corpora still give
+// stable numbers
+const int BENCH_POSITIONS = 2000;
+
+// Replays a corpus of FENs through the same code as GET /, without HTTP, and
+// reports throughput and latency. Also used as the workload for PGO builds.
+// With a list of material signatures the corpus is generated instead, with
+// the same random positions on every run.
+int bench(const char *path, const char *materials) {
+  std::vector<std::vector<std::string>> corpus(routes.size());
+  if (materials) {
+      for (size_t i = 0; i < corpus.size(); i++) {
+          EndgameGenerator generator(routes[i].variant, 0x9E3779B97F4A7C15ULL);
+          if (!generator.add_list(materials) || generator.empty()) {
+              std::cout << "invalid material for " << variants[routes[i].variant] << ": " << materials << std::endl;
+              return 78;
+          }
+
+          StateInfo st;
+          Position pos;
+          for (int j = 0; j < BENCH_POSITIONS; j++) {
+              generator.next(pos, &st);
+              corpus[i].push_back(pos.fen());
+          }
+      }
+  } else {
+      std::vector<std::string> fens;
+      if (path) {
+          std::ifstream file(path);
+          if (!file.is_open()) {
+              std::cout << "could not open " << path << std::endl;
+              return 78;
+          }
+          std::string fen;
+          while (std::getline(file, fen)) {
+              if (!fen.empty()) fens.push_back(fen);
+          }
+      } else {
+          fens.assign(bench_fens, bench_fens + sizeof(bench_fens) / sizeof(bench_fens[0]));
+      }
+
+      if (fens.empty()) {
+          std::cout << "no positions to replay" << std::endl;
+          return 78;
+      }
+
+      for (auto &route_fens : corpus) route_fens = fens;
+  }
+
+  struct evbuffer *res = evbuffer_new();
+  if (!res) {
+      std::cout << "could not allocate response buffer" << std::endl;
+      abort();
+  }
+
+  std::vector<int64_t> latencies;
+  size_t rejected = 0;
+  size_t bytes = 0;
+  size_t passes = (BENCH_POSITIONS + corpus[0].size() - 1) / corpus[0].size();
+  probes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t pass = 0; pass < passes; pass++) {
+      for (size_t i = 0; i < corpus.size(); i++) {
+          const Route &route = routes[i];
+          for (const std::string &fen : corpus[i]) {
+              auto begin = std::chrono::steady_clock::now();
+
+              Request r(route.variant);
+              r.fen = fen.c_str();
+              Tablebases::StateFrame states(2);
+              Position pos;
+              if (pos.parse_fen(r.fen, true, r.variant, &states[0], nullptr) != FEN_OK) {
+                  if (!pass) {
+                      std::cout << "skipping " << variants[route.variant] << " " << fen << std::endl;
+                      rejected++;
+                  }
+                  continue;
+              }
+
+              write_moves(pos, r, states[1], res);
+              Arena::local().reset();
+              bytes += evbuffer_get_length(res);
+              evbuffer_drain(res, evbuffer_get_length(res));
+
+              latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - begin).count());
+          }
+      }
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  evbuffer_free(res);
+
+  if (latencies.empty()) {
+      std::cout << "all positions rejected" << std::endl;
+      return 65;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) { return latencies[size_t(p * (latencies.size() - 1))]; };
+
+  std::cout << "\n==========================="
+            << "\nPositions         : " << latencies.size()
+            << "\nRejected FENs     : " << rejected
+            << "\nResponse bytes    : " << bytes
+            << "\nTotal time (ms)   : " << int64_t(elapsed * 1000)
+            << "\nPositions/second  : " << int64_t(latencies.size() / elapsed)
+            << "\nProbes/second     : " << int64_t(probes / elapsed)
+            << "\nLatency p50 (us)  : " << percentile(0.5)
+            << "\nLatency p90 (us)  : " << percentile(0.9)
+            << "\nLatency p99 (us)  : " << percentile(0.99)
+            << "\nLatency max (us)  : " << latencies.back() << std::endl;
+
+  return 0;
+}
+
 }  // namespace
 
 int main(int argc, char* argv[]) {
@@ -621,8 +822,20 @@ int main(int argc, char* argv[]) {
 
   char *syzygy_path = NULL;
 
+  const char *shm_name = NULL;
+  int shm_slots = 64;
+  int shm_workers = 1;
+
+  bool bench_mode = false;
+  const char *bench_path = NULL;
+  const char *bench_materials = NULL;
+
+  const char *huge_tables = NULL;
+
 #ifdef GAVIOTA
   const char **gaviota_paths = tbpaths_init();
+  int gaviota_cache = 32;  // MiB
+  int gaviota_wdl_fraction = 10;  // Percent of the cache for WDL
   if (!gaviota_paths) {
       std::cout << "tbpaths_init failed" << std::endl;
       abort();
@@ -633,10 +846,25 @@ int main(int argc, char* argv[]) {
   static struct option long_options[] = {
       {"verbose", no_argument,       &verbose, 1},
       {"cors",    no_argument,       &cors, 1},
+      {"numa",    no_argument,       &numa, 1},
       {"port",    required_argument, 0, 'p'},
       {"syzygy",  required_argument, 0, 's'},
+      {"bench",   optional_argument, 0, 'b'},
+      {"bench-material", required_argument, 0, 'm'},
+      {"trace-sample", required_argument, 0, 't'},
+      {"trace-inline", no_argument, &trace_inline, 1},
+      {"access-log", required_argument, 0, 'l'},
+      {"workers", required_argument, 0, 'w'},
+      {"queue",   required_argument, 0, 'q'},
+      {"batch-pieces", required_argument, 0, 'n'},
+      {"shm",     required_argument, 0, 'M'},
+      {"shm-slots", required_argument, 0, 'S'},
+      {"shm-workers", required_argument, 0, 'W'},
+      {"huge-tables", required_argument, 0, 'H'},
 #ifdef GAVIOTA
       {"gaviota", required_argument, 0, 'g'},
+      {"gaviota-cache", required_argument, 0, 'C'},
+      {"gaviota-wdl-fraction", required_argument, 0, 'F'},
 #endif
       {NULL, 0, 0, 0},
   };
@@ -656,6 +884,87 @@ int main(int argc, char* argv[]) {
           case 0:
               break;
 
+          case 'b':
+              bench_mode = true;
+              bench_path = optarg;
+              break;
+
+          case 'm':
+              bench_mode = true;
+              bench_materials = optarg;
+              break;
+
+          case 't':
+              trace_sample = atoi(optarg);
+              if (trace_sample < 1) {
+                  printf("invalid trace sample rate: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'l':
+              if (access_log.is_open()) {
+                  std::cout << "--access-log given more than once" << std::endl;
+                  return 78;
+              }
+              if (!access_log.open(optarg)) {
+                  std::cout << "could not open access log " << optarg << std::endl;
+                  return 78;
+              }
+              break;
+
+          case 'w':
+              num_workers = atoi(optarg);
+              if (num_workers < 0) {
+                  printf("invalid number of workers: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'q':
+              queue_size = atoi(optarg);
+              if (queue_size < 1) {
+                  printf("invalid queue size: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'n':
+              batch_pieces = atoi(optarg);
+              if (batch_pieces < 2) {
+                  printf("invalid number of batch pieces: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'M':
+              if (optarg[0] != '/' || strchr(optarg + 1, '/')) {
+                  printf("invalid shared memory name: %s (expected /name)\n", optarg);
+                  return 78;
+              }
+              shm_name = optarg;
+              break;
+
+          case 'S':
+              shm_slots = atoi(optarg);
+              if (shm_slots < 1 || shm_slots > 65536) {
+                  printf("invalid number of shared memory slots: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'W':
+              shm_workers = atoi(optarg);
+              if (shm_workers < 1) {
+                  printf("invalid number of shared memory workers: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'H':
+              huge_tables = optarg;
+              break;
+
           case 'p':
               port = atoi(optarg);
               if (!port) {
@@ -682,6 +991,22 @@ int main(int argc, char* argv[]) {
                   abort();
               }
               break;
+
+          case 'C':
+              gaviota_cache = atoi(optarg);
+              if (gaviota_cache < 1) {
+                  printf("invalid gaviota cache size: %s\n", optarg);
+                  return 78;
+              }
+              break;
+
+          case 'F':
+              gaviota_wdl_fraction = atoi(optarg);
+              if (gaviota_wdl_fraction < 0 || gaviota_wdl_fraction > 100) {
+                  printf("invalid gaviota wdl fraction: %s\n", optarg);
+                  return 78;
+              }
+              break;
 #endif
 
           case '?':
@@ -698,31 +1023,60 @@ int main(int argc, char* argv[]) {
       return 78;
   }
 
-  if (!syzygy_path) {
+  // Benchmarks may run without tables, e.g. for PGO builds
+  if (!syzygy_path && !bench_mode) {
       std::cout << "at least some syzygy tables are required (--syzygy)" << std::endl;
       return 78;
   }
 
   std::cout << "SYZYGY initialization" << std::endl;
 
-  UCI::init(Options);
-  PSQT::init();
-  Bitboards::init();
-  Position::init();
-  Threads.init(Options["Threads"]);
-  Tablebases::init(syzygy_path, TABLEBASE_VARIANT);
+  if (!syzygy_path) syzygy_path = strdup("<empty>");
+  tb_open(syzygy_path);  // All variants of the routes
 
-  if (Tablebases::MaxCardinality < 3) {
+  if (Tablebases::MaxCardinality < 3 && !bench_mode) {
       std::cout << "at least some syzygy tables are required (--syzygy " << syzygy_path << ")" << std::endl;
       return 78;
   }
 
   std::cout << "  Path = " << syzygy_path << std::endl;
-  std::cout << "  Cardinality = " << Tablebases::MaxCardinality << std::endl;
+  for (const Route &route : routes) {
+      std::cout << "  Cardinality (" << variants[route.variant] << ") = " << Tablebases::VariantMaxCardinality[route.variant] << std::endl;
+  }
+
+  // Read the hottest tables into huge pages rather than mapping them lazily
+  if (huge_tables) {
+      std::stringstream materials(huge_tables);
+      std::string material;
+      while (std::getline(materials, material, ',')) {
+          // Workers bound to a node then probe their own copy, so the shared
+          // original is not read into huge pages as well
+          if (numa) {
+              int nodes = 0;
+              for (const Route &route : routes) {
+                  nodes = std::max(nodes, Tablebases::replicate(material, route.variant));
+              }
+              if (nodes) {
+                  std::cout << "  Replicated = " << material << " (" << nodes << " NUMA nodes)" << std::endl;
+                  continue;
+              }
+          }
+
+          int loaded = 0;
+          for (const Route &route : routes) {
+              loaded += Tablebases::load_huge(material, route.variant);
+          }
+          if (!loaded) {
+              std::cout << "no syzygy tables for " << material << " (--huge-tables)" << std::endl;
+              return 78;
+          }
+          std::cout << "  Huge pages = " << material << " (" << loaded << (loaded == 1 ? " table)" : " tables)") << std::endl;
+      }
+  }
   std::cout << std::endl;
 
 #ifdef GAVIOTA
-  tbcache_init(32 * 1024 * 1024, 10);  // 32 MiB, 10% WDL
+  tbcache_init(size_t(gaviota_cache) * 1024 * 1024, gaviota_wdl_fraction);
   tbstats_reset();
   char *info = tb_init(true, tb_CP4, gaviota_paths);
   if (info) {
@@ -730,5 +1084,14 @@ int main(int argc, char* argv[]) {
   }
 #endif
 
-  return serve(port);
+  if (shm_name && !bench_mode) {
+      if (!shm_server.open(shm_name, shm_slots)) {
+          std::cout << "could not create shared memory " << shm_name << ": " << strerror(errno) << std::endl;
+          return 78;
+      }
+      shm_server.start(shm_workers, numa);
+      std::cout << "Shared memory " << shm_name << " with " << shm_slots << " slots" << std::endl;
+  }
+
+  return bench_mode ? bench(bench_path, bench_materials) : serve(port);
 }
@@ -0,0 +1,357 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TBSHM_H_INCLUDED
+#define TBSHM_H_INCLUDED
+
+/* kill(), syscall() and struct timespec are not declared with a strict
+   -std=c99. The feature macro only takes effect if this header is included
+   before any system header, otherwise compile with -D_GNU_SOURCE. */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+/* Shared memory transport for clients on the same host, e.g. a PHP frontend
+   that cannot load the C interface of tbapi.h into its own process.
+
+   The server (--shm /name) creates a POSIX shared memory segment with a
+   header, a queue of submitted slots and --shm-slots request slots. A client
+   claims a free slot, writes the request into it, puts the slot index into
+   the queue and waits until the server has written the response into the
+   same slot:
+
+     FREE -> CLAIMED -> SUBMITTED -> DONE -> FREE
+         client     client       server   client
+
+   The client records its pid in the slot it claims. If it dies before freeing
+   the slot, another client that finds no free slot takes it over, once the
+   slot is CLAIMED or DONE and the pid no longer exists.
+
+   The queue is a bounded lock-free MPMC ring (Dmitry Vyukov's) with one cell
+   per slot, so it cannot overflow. Both sides spin briefly before sleeping on
+   a futex: workers on the doorbell, clients on the state of their slot. A
+   sleeper announces itself first, so that the other side only makes the
+   wake up system call when needed. Spinning is pointless with a single CPU
+   for both sides, so the server publishes how long to spin in the header.
+
+   All shared fields are accessed with the __atomic builtins of GCC and Clang.
+   Results are the tb_result and tb_move of tbapi.h. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tbapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TB_SHM_MAGIC   0x6d687374u  /* "tshm" */
+#define TB_SHM_VERSION 2u
+
+/* Default for spin, about a few microseconds */
+#define TB_SHM_SPIN 2000
+
+#define TB_SHM_FEN_SIZE 128
+#define TB_SHM_MAX_MOVES 256
+
+/* Returned by the client when all slots are in use */
+#define TB_SHM_ERROR_BUSY (-16)
+
+enum tb_shm_op {
+  TB_SHM_PROBE_FEN = 0,   /* Like tb_probe_fen() */
+  TB_SHM_PROBE_MOVES = 1  /* Like tb_probe_moves() */
+};
+
+enum tb_shm_state {
+  TB_SHM_FREE = 0,
+  TB_SHM_CLAIMED = 1,
+  TB_SHM_SUBMITTED = 2,
+  TB_SHM_DONE = 3
+};
+
+struct tb_shm_slot {
+  uint32_t state;    /* tb_shm_state, the futex clients wait on */
+  uint32_t waiting;  /* Client is asleep */
+  int32_t owner;     /* pid of the client that claimed the slot */
+
+  /* Request */
+  int32_t op;
+  int32_t variant;
+  int32_t mode;
+  char fen[TB_SHM_FEN_SIZE];
+
+  /* Response: the return value of tb_probe_fen() or tb_probe_moves() */
+  int32_t status;
+  struct tb_result result;
+  struct tb_move moves[TB_SHM_MAX_MOVES];
+};
+
+struct tb_shm_cell {
+  uint32_t sequence;
+  uint32_t slot;
+};
+
+struct tb_shm_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_slots;   /* Power of two */
+  uint32_t slot_size;   /* sizeof(struct tb_shm_slot) of the server */
+  uint32_t cells_offset;
+  uint32_t slots_offset;
+  uint32_t spin;        /* Iterations to spin before sleeping, 0 on a single CPU */
+  int32_t pid;          /* Of the server, to detect a stale segment */
+
+  /* Each on a cache line of its own */
+  char pad0[32];
+  uint32_t enqueue_pos;
+  char pad1[60];
+  uint32_t dequeue_pos;
+  char pad2[60];
+  uint32_t doorbell;    /* Incremented for every submission, futex of the workers */
+  uint32_t sleepers;    /* Workers asleep on the doorbell */
+  char pad3[56];
+};
+
+static inline struct tb_shm_cell *tb_shm_cells(struct tb_shm_header *h) {
+  return (struct tb_shm_cell *)((char *)h + h->cells_offset);
+}
+
+static inline struct tb_shm_slot *tb_shm_slot_at(struct tb_shm_header *h, uint32_t i) {
+  return (struct tb_shm_slot *)((char *)h + h->slots_offset) + i;
+}
+
+/* Size of a segment with the given number of slots */
+static inline size_t tb_shm_size(uint32_t num_slots) {
+  size_t cells = (sizeof(struct tb_shm_header) + 63) & ~(size_t)63;
+  size_t slots = (cells + num_slots * sizeof(struct tb_shm_cell) + 63) & ~(size_t)63;
+  return slots + num_slots * sizeof(struct tb_shm_slot);
+}
+
+/* The queue operations take the cells and the mask explicitly, so that the
+   server can use its own copies rather than trusting the shared header */
+static inline int tb_shm_queue_pop(struct tb_shm_header *h, struct tb_shm_cell *cells, uint32_t mask, uint32_t *slot);
+
+static inline void tb_shm_push(struct tb_shm_header *h, uint32_t slot) {
+  struct tb_shm_cell *cells = tb_shm_cells(h);
+  uint32_t mask = h->num_slots - 1;
+  uint32_t pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    struct tb_shm_cell *cell = &cells[pos & mask];
+    int32_t diff = (int32_t)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&h->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell->slot = slot;
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+        return;
+      }
+    } else {
+      /* Never full: there are as many cells as slots */
+      pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/* Returns 0 if the queue is empty */
+static inline int tb_shm_pop(struct tb_shm_header *h, uint32_t *slot) {
+  return tb_shm_queue_pop(h, tb_shm_cells(h), h->num_slots - 1, slot);
+}
+
+/* The slot indices in the cells are written by clients and unchecked */
+static inline int tb_shm_queue_pop(struct tb_shm_header *h, struct tb_shm_cell *cells, uint32_t mask, uint32_t *slot) {
+  uint32_t pos = __atomic_load_n(&h->dequeue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    struct tb_shm_cell *cell = &cells[pos & mask];
+    int32_t diff = (int32_t)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&h->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *slot = cell->slot;
+        __atomic_store_n(&cell->sequence, pos + mask + 1, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&h->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static inline int tb_shm_process_alive(pid_t pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static inline int tb_shm_server_alive(struct tb_shm_header *h) {
+  return tb_shm_process_alive(h->pid);
+}
+
+/* Takes over a slot left CLAIMED or DONE by a client that died. Returns 1 if
+   the slot now belongs to the caller, in the CLAIMED state. */
+static inline int tb_shm_reclaim(struct tb_shm_slot *s) {
+  int32_t owner = __atomic_load_n(&s->owner, __ATOMIC_ACQUIRE);
+  uint32_t state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+  if ((state != TB_SHM_CLAIMED && state != TB_SHM_DONE) || owner <= 0 || tb_shm_process_alive(owner))
+    return 0;
+
+  /* Other clients may race for the same slot: only one swaps the owner */
+  if (!__atomic_compare_exchange_n(&s->owner, &owner, (int32_t)getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    return 0;
+
+  /* A DONE slot may have been freed and claimed anew meanwhile */
+  uint32_t expected = TB_SHM_DONE;
+  if (__atomic_compare_exchange_n(&s->state, &expected, TB_SHM_CLAIMED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 1;
+  return expected == TB_SHM_CLAIMED;
+}
+
+static inline void tb_shm_futex_wait(uint32_t *addr, uint32_t value, const struct timespec *timeout) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static inline void tb_shm_futex_wake(uint32_t *addr, int count) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/* Maps the segment of a running server, e.g. tb_shm_attach("/tbserve").
+   Returns NULL on failure. The server has to be in the same PID namespace. */
+static inline struct tb_shm_header *tb_shm_attach(const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct tb_shm_header))
+    p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return NULL;
+
+  struct tb_shm_header *h = (struct tb_shm_header *)p;
+  if (h->magic != TB_SHM_MAGIC || h->version != TB_SHM_VERSION
+      || h->slot_size != sizeof(struct tb_shm_slot)
+      || (size_t)st.st_size < tb_shm_size(h->num_slots)
+      || !tb_shm_server_alive(h)) {
+    munmap(p, st.st_size);
+    return NULL;
+  }
+  return h;
+}
+
+static inline void tb_shm_detach(struct tb_shm_header *h) {
+  munmap(h, tb_shm_size(h->num_slots));
+}
+
+/* Sends a request and waits for the response. Returns what tb_probe_fen() or
+   tb_probe_moves() would, TB_SHM_ERROR_BUSY, or TB_ERROR_CLOSED if the
+   server has gone away. moves may be NULL for TB_SHM_PROBE_FEN, result for
+   TB_SHM_PROBE_MOVES. */
+static inline int tb_shm_probe(struct tb_shm_header *h, int op, int variant, const char *fen, int mode,
+                               struct tb_result *result, struct tb_move *moves, size_t capacity) {
+  if (!fen || strlen(fen) >= TB_SHM_FEN_SIZE) return TB_ERROR_ARGUMENT;
+
+  /* Claim a free slot, starting at one that depends on the caller */
+  uint32_t start = (uint32_t)((uintptr_t)&start >> 12) ^ (uint32_t)getpid();
+  struct tb_shm_slot *slot = NULL;
+  uint32_t index = 0;
+  for (uint32_t i = 0; i < h->num_slots; i++) {
+    index = (start + i) & (h->num_slots - 1);
+    uint32_t expected = TB_SHM_FREE;
+    struct tb_shm_slot *s = tb_shm_slot_at(h, index);
+    if (__atomic_compare_exchange_n(&s->state, &expected, TB_SHM_CLAIMED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&s->owner, (int32_t)getpid(), __ATOMIC_RELEASE);
+      slot = s;
+      break;
+    }
+  }
+
+  /* All taken: look for slots of clients that died */
+  for (uint32_t i = 0; !slot && i < h->num_slots; i++) {
+    index = (start + i) & (h->num_slots - 1);
+    if (tb_shm_reclaim(tb_shm_slot_at(h, index)))
+      slot = tb_shm_slot_at(h, index);
+  }
+  if (!slot) return TB_SHM_ERROR_BUSY;
+
+  slot->op = op;
+  slot->variant = variant;
+  slot->mode = mode;
+  strcpy(slot->fen, fen);
+  __atomic_store_n(&slot->waiting, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->state, TB_SHM_SUBMITTED, __ATOMIC_RELEASE);
+
+  tb_shm_push(h, index);
+  __atomic_add_fetch(&h->doorbell, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->sleepers, __ATOMIC_SEQ_CST))
+    tb_shm_futex_wake(&h->doorbell, 1);
+
+  /* Wait for the response, checking every 100 ms that the server still
+     exists. The slot of a request to a dead server is never freed. */
+  const struct timespec timeout = { 0, 100 * 1000 * 1000 };
+  for (uint32_t spin = 0; __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != TB_SHM_DONE; ) {
+    if (spin < h->spin) {
+      spin++;
+      continue;
+    }
+    __atomic_store_n(&slot->waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->state, __ATOMIC_SEQ_CST) != TB_SHM_DONE) {
+      tb_shm_futex_wait(&slot->state, TB_SHM_SUBMITTED, &timeout);
+      if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != TB_SHM_DONE && !tb_shm_server_alive(h))
+        return TB_ERROR_CLOSED;
+    }
+  }
+
+  int status = slot->status;
+  if (op == TB_SHM_PROBE_FEN && status == TB_OK && result)
+    *result = slot->result;
+  if (op == TB_SHM_PROBE_MOVES && status > 0) {
+    if ((size_t)status > capacity) status = TB_ERROR_BUFFER;
+    else memcpy(moves, slot->moves, status * sizeof(struct tb_move));
+  }
+
+  /* Clear the owner first, so that a new claim is never taken for a dead one */
+  __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->state, TB_SHM_FREE, __ATOMIC_RELEASE);
+  return status;
+}
+
+#endif /* __linux__ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef TBSHM_H_INCLUDED */
@@ -0,0 +1,152 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/resource.h>
+
+#include "trace.h"
+
+namespace {
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+        (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Page faults of the calling thread so far
+void page_faults(int64_t& minflt, int64_t& majflt) {
+
+  struct rusage usage;
+#ifdef RUSAGE_THREAD
+  if (!getrusage(RUSAGE_THREAD, &usage))
+#else
+  if (!getrusage(RUSAGE_SELF, &usage))
+#endif
+  {
+      minflt = usage.ru_minflt;
+      majflt = usage.ru_majflt;
+  }
+  else
+      minflt = majflt = 0;
+}
+
+// Appends s as the contents of a JSON string
+void escape(std::string& out, const char* s) {
+
+  for ( ; *s; ++s)
+      if (*s == '"' || *s == '\\')
+          out += '\\', out += *s;
+      else if ((unsigned char)*s < 0x20)
+          out += ' ';
+      else
+          out += *s;
+}
+
+} // namespace
+
+namespace Trace {
+
+/// Recorder::add() stores an event, replacing the oldest one if the
+/// recorder is full.
+
+void Recorder::add(const Event& e) {
+
+  if (events.size() < capacity)
+      events.push_back(e);
+  else if (capacity)
+  {
+      events[next] = e;
+      next = (next + 1) % capacity;
+      dropped++;
+  }
+}
+
+
+/// Recorder::append() adds the events of another recorder, oldest first
+
+void Recorder::append(const Recorder& other) {
+
+  for (size_t i = 0; i < other.events.size(); ++i)
+      add(other.events[(other.next + i) % other.events.size()]);
+
+  dropped += other.dropped;
+}
+
+
+/// Recorder::write_json() appends the events, oldest first, as a JSON object
+/// that chrome://tracing and Perfetto can load.
+
+void Recorder::write_json(std::string& out) const {
+
+  char buf[160];
+  out += "{\"traceEvents\": [";
+
+  for (size_t i = 0; i < events.size(); ++i)
+  {
+      const Event& e = events[(next + i) % events.size()];
+
+      snprintf(buf, sizeof(buf), "%s\n{\"name\": \"%s\", \"cat\": \"tbserve\", \"ph\": \"X\", "
+               "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1, \"args\": {\"detail\": \"",
+               i ? "," : "", e.name, e.begin / 1000.0, e.duration / 1000.0);
+      out += buf;
+      escape(out, e.detail);
+      snprintf(buf, sizeof(buf), "\", \"minflt\": %lld, \"majflt\": %lld}}",
+               (long long)e.minflt, (long long)e.majflt);
+      out += buf;
+  }
+
+  snprintf(buf, sizeof(buf), "],\n\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped\": %llu}}",
+           (unsigned long long)dropped);
+  out += buf;
+}
+
+
+void Scope::start(const char* name, const char* detail) {
+
+  event.name = name;
+  strncpy(event.detail, detail ? detail : "", sizeof(event.detail) - 1);
+  event.detail[sizeof(event.detail) - 1] = '\0';
+  page_faults(event.minflt, event.majflt);
+  event.begin = now_ns();
+}
+
+
+void Scope::finish() {
+
+  event.duration = now_ns() - event.begin;
+
+  int64_t minflt, majflt;
+  page_faults(minflt, majflt);
+  event.minflt = minflt - event.minflt;
+  event.majflt = majflt - event.majflt;
+
+  recorder->add(event);
+  recorder = nullptr;
+}
+
+} // namespace Trace
@@ -0,0 +1,98 @@
+/*
+  tbserve, a syzygy tablebase server
+  Copyright (C) 2016 Niklas Fiekas <niklas.fiekas@backscattering.de>
+
+  based on
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Opt-in tracing of where the time of a request goes. While a Recorder is
+/// active on the current thread, every Trace::Scope records a complete event
+/// with its duration and the page faults it caused. Without an active
+/// recorder a scope costs a thread local load and a branch.
+
+namespace Trace {
+
+struct Event {
+  const char* name;
+  char detail[96];
+  int64_t begin;    // Nanoseconds on the steady clock
+  int64_t duration; // Nanoseconds
+  int64_t minflt;   // Page faults during the event
+  int64_t majflt;
+};
+
+/// Recorder keeps the most recent events up to its capacity, overwriting the
+/// oldest ones, and writes them in the Chrome trace event format.
+
+class Recorder {
+public:
+  explicit Recorder(size_t size) : capacity(size) {}
+
+  void add(const Event& e);
+  void append(const Recorder& other);
+  void clear() { events.clear(); next = 0; dropped = 0; }
+  void write_json(std::string& out) const;
+
+private:
+  size_t capacity;
+  std::vector<Event> events;
+  size_t next = 0;     // Slot of the next event once the ring is full
+  uint64_t dropped = 0;
+};
+
+/// The recorder of the current thread, if any. Kept local to an inline
+/// function, so that no TLS wrapper is needed to reach it.
+inline Recorder*& active() {
+  static thread_local Recorder* recorder = nullptr;
+  return recorder;
+}
+
+class Scope {
+public:
+  explicit Scope(const char* name, const char* detail = nullptr) : recorder(active()) {
+      if (recorder)
+          start(name, detail);
+  }
+  ~Scope() { stop(); }
+
+  void stop() {
+      if (recorder)
+          finish();
+  }
+
+private:
+  void start(const char* name, const char* detail);
+  void finish();
+
+  Recorder* recorder;
+  Event event;
+};
+
+} // namespace Trace
+
+#endif // #ifndef TRACE_H_INCLUDED
@@ -93,6 +93,14 @@ const bool HasPext = true;
 const bool HasPext = false;
 #endif
 
+/// With USE_DISPATCH the hottest functions are compiled for several instruction
+/// sets and the dynamic loader picks the best one for the host CPU.
+#if defined(USE_DISPATCH) && defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#  define DISPATCH_CLONES __attribute__((target_clones("default", "popcnt", "arch=haswell")))
+#else
+#  define DISPATCH_CLONES
+#endif
+
 #ifdef IS_64BIT
 const bool Is64Bit = true;
 #else
@@ -23,18 +23,21 @@
 #include <sstream>
 #include <string>
 
-#include "evaluate.h"
 #include "movegen.h"
 #include "position.h"
+#include "uci.h"
+#ifndef TBCORE
+#include "evaluate.h"
 #include "search.h"
 #include "thread.h"
 #include "tt.h"
 #include "timeman.h"
-#include "uci.h"
 #include "syzygy/tbprobe.h"
+#endif
 
 using namespace std;
 
+#ifndef TBCORE
 extern vector<string> setup_bench(const Position&, istream&);
 
 namespace {
@@ -304,6 +307,7 @@ void UCI::loop(int argc, char* argv[]) {
 
   } while (token != "quit" && argc == 1); // Command line args are one-shot
 }
+#endif
 
 
 /// UCI::value() converts a Value to a string suitable for use with the UCI
@@ -0,0 +1,101 @@
+#!/bin/bash
+# compare --bench throughput of a baseline commit and the working tree
+#
+# usage: perfregress.sh [baseline] (default HEAD)
+#
+# Both trees are exported with git archive and built the same way. The server
+# then replays a fixed set of random endgames (--bench-material), alternating
+# between baseline and candidate to cancel out drift of the machine. Fails if
+# the candidate is slower by more than THRESHOLD percent and the 95%
+# confidence interval of the difference lies entirely below zero.
+#
+# environment:
+#   SYZYGY     tables to probe, without them only move generation and output
+#              are measured
+#   MATERIAL   material signatures of the benchmark positions
+#   RUNS       runs per build (default 10)
+#   THRESHOLD  tolerated slowdown in percent (default 2)
+#   MAKEFILE   regular, atomic, giveaway or multi (default regular)
+#   ARCH       passed to make (default x86-64-modern)
+#   MAKEARGS   further arguments to make, e.g. EXTRACXXFLAGS=-I/opt/gtb/include
+
+error()
+{
+  echo "perf regression testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+baseline=${1:-HEAD}
+runs=${RUNS:-10}
+threshold=${THRESHOLD:-2}
+makefile=${MAKEFILE:-regular}
+arch=${ARCH:-x86-64-modern}
+material=${MATERIAL:-KPvK,KQvK,KRvK,KBNvK,KRvKB,KQvKR,KRPvKR,KPPvKP,KRBvKR,KQPvKQ}
+
+case $makefile in
+  regular)  exe=rtbserve ;;
+  atomic)   exe=atbserve ;;
+  giveaway) exe=gtbserve ;;
+  multi)    exe=tbserve ;;
+  *)        echo "unknown makefile: $makefile"; exit 1 ;;
+esac
+
+echo "perf regression testing started"
+
+cd "$(git rev-parse --show-toplevel)"
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+# snapshot of the working tree, including uncommitted changes to tracked files
+candidate=$(git stash create)
+candidate=${candidate:-HEAD}
+
+for build in baseline candidate; do
+  mkdir "$workdir/$build"
+  git archive "${!build}" | tar -x -C "$workdir/$build"
+  make -C "$workdir/$build/src" -f Makefile.$makefile -j"$(nproc)" ARCH=$arch $MAKEARGS build > "$workdir/$build.log" 2>&1 \
+    || { tail -20 "$workdir/$build.log"; echo "building $build failed"; exit 1; }
+done
+
+args="--bench-material=$material"
+[ -n "$SYZYGY" ] && args="$args --syzygy $SYZYGY" || echo "SYZYGY not set, measuring without tables"
+
+measure()
+{
+  "$workdir/$1/src/$exe" $args 2>&1 | awk '/^Positions\/second/ { print $3 }'
+}
+
+for i in $(seq $runs); do
+  measure baseline >> "$workdir/baseline.txt"
+  measure candidate >> "$workdir/candidate.txt"
+done
+
+# Welch's t-test on the positions per second of both builds
+paste "$workdir/baseline.txt" "$workdir/candidate.txt" | awk -v threshold=$threshold '
+  function tquantile(df) {
+    # 97.5% quantile of Student'"'"'s t distribution
+    split("12.71 4.30 3.18 2.78 2.57 2.45 2.36 2.31 2.26 2.23 2.20 2.18 2.16 2.14 2.13 2.12 2.11 2.10 2.09 2.09 2.08 2.07 2.07 2.06 2.06 2.06 2.05 2.05 2.05 2.04", t)
+    df = int(df)
+    return df < 1 ? t[1] : df <= 30 ? t[df] : 1.96
+  }
+  { n++; b[n] = $1; c[n] = $2; sb += $1; sc += $2 }
+  END {
+    mb = sb / n; mc = sc / n
+    for (i = 1; i <= n; i++) { vb += (b[i] - mb) ^ 2; vc += (c[i] - mc) ^ 2 }
+    vb /= n - 1; vc /= n - 1
+    se = sqrt(vb / n + vc / n)
+    df = se ? (vb / n + vc / n) ^ 2 / ((vb / n) ^ 2 / (n - 1) + (vc / n) ^ 2 / (n - 1)) : 2 * n - 2
+    diff = mc - mb
+    lo = 100 * (diff - tquantile(df) * se) / mb
+    hi = 100 * (diff + tquantile(df) * se) / mb
+    printf "baseline  : %d +- %d positions/second\n", mb, sqrt(vb)
+    printf "candidate : %d +- %d positions/second\n", mc, sqrt(vc)
+    printf "change    : %+.2f%% (95%% CI %+.2f%% .. %+.2f%%, %d runs each)\n", 100 * diff / mb, lo, hi, n
+    if (100 * diff / mb < -threshold && hi < 0) {
+      printf "candidate is more than %s%% slower\n", threshold
+      exit 1
+    }
+  }' || { echo "perf regression testing failed"; exit 1; }
+
+echo "perf regression testing OK"